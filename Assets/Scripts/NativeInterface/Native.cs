@@ -7,6 +7,56 @@ using UnityEngine;
 namespace Voxulkan
 {
 
+    [StructLayout(LayoutKind.Sequential)]
+    public struct StagingPoolStats
+    {
+        public uint count;
+        public uint available;
+        public uint backlog;
+        public uint starved;
+        public ulong allocations;
+        public ulong retirements;
+        public ulong byteCount;
+        public ulong byteBudget;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct MeshArenaStats
+    {
+        public ulong usedBytes;
+        public ulong capacityBytes;
+        public ulong largestFreeBytes;
+        public uint rangeCount;
+        public uint freeBlockCount;
+        public uint pageCount;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ResourceCacheStats
+    {
+        public ulong hits;
+        public ulong misses;
+        public ulong evictions;
+        public ulong idleBytes;
+        public ulong byteBudget;
+        public uint idleCount;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct MemoryStats
+    {
+        public ulong otherBytes;
+        public ulong meshBytes;
+        public ulong stagingBytes;
+        public ulong materialBytes;
+        public ulong usage;
+        public ulong budget;
+        public ulong target;
+        public float errorScale;
+        public uint allocationFailures;
+        public uint budgetExtension;
+    }
+
 #if UNITY_EDITOR
     [UnityEditor.InitializeOnLoad]
 #endif
@@ -35,6 +85,10 @@ namespace Voxulkan
             byte[] surfaceAnalysis, int analysisSize,
             byte[] surfaceAssembly, int assemblySize);
         [DllImport(DLL)]
+        public static extern void SetCullShaders(IntPtr instance,
+            byte[] chunkCull, int cullSize,
+            byte[] depthPyramid, int pyramidSize);
+        [DllImport(DLL)]
         public static extern void SetMaterialResources(IntPtr instance, VoxelMaterialAttributes[] attributes, uint attribsByteCount,
             byte[] csData, uint csWidth, uint csHeight,
             byte[] nhData, uint nhWidth, uint nhHeight,
@@ -56,6 +110,26 @@ namespace Voxulkan
         public static extern void InitializeVoxulkanInstance(IntPtr instance);
         [DllImport(DLL)]
         public static extern void InvokeGC(IntPtr instance);
+        [DllImport(DLL)]
+        public static extern void SetBuildBudget(IntPtr instance, uint budget);
+        [DllImport(DLL)]
+        public static extern void SetStagingBudget(IntPtr instance, ulong byteBudget);
+        [DllImport(DLL)]
+        public static extern void SetMeshOptimization(IntPtr instance, [MarshalAs(UnmanagedType.U1)] bool enabled);
+        [DllImport(DLL)]
+        public static extern void SetJobWorkerCount(IntPtr instance, uint count);
+        [DllImport(DLL)]
+        public static extern void GetStagingStats(IntPtr instance, out StagingPoolStats stats);
+        [DllImport(DLL)]
+        public static extern void GetMeshArenaStats(IntPtr instance, out MeshArenaStats stats);
+        [DllImport(DLL)]
+        public static extern void GetResourceCacheStats(IntPtr instance, out ResourceCacheStats stats);
+        [DllImport(DLL)]
+        public static extern void SetMemoryBudget(IntPtr instance, ulong byteBudget);
+        [DllImport(DLL)]
+        public static extern void SetMemoryHysteresis(IntPtr instance, uint stepFrames, float releaseFraction);
+        [DllImport(DLL)]
+        public static extern void GetMemoryStats(IntPtr instance, out MemoryStats stats);
 
 
         [DllImport(DLL)]
@@ -65,6 +139,10 @@ namespace Voxulkan
         [DllImport(DLL)]
         public static extern void SetVoxelBodyTransform(IntPtr voxelBody, Matrix4x4 transform);
         [DllImport(DLL)]
+        public static extern void SetVoxelBodyParallelDepth(IntPtr voxelBody, uint parallelDepth);
+        [DllImport(DLL)]
+        public static extern void SetVoxelBodyIncremental(IntPtr voxelBody, [MarshalAs(UnmanagedType.U1)] bool incremental);
+        [DllImport(DLL)]
         public static extern unsafe void VBTraverse(IntPtr instance, IntPtr vb, Vector3 observerPosition, float E, float voxelSize, void* forms, uint formsCount, uint maxDepth = 10);
 
         [DllImport(DLL)]
@@ -79,6 +157,11 @@ namespace Voxulkan
         {
             return Resources.Load<TextAsset>("NativeShaders/" + shaderName).bytes;
         }
+        public static byte[] TryLoadShaderBytes(string shaderName)
+        {
+            TextAsset shader = Resources.Load<TextAsset>("NativeShaders/" + shaderName);
+            return shader != null ? shader.bytes : null;
+        }
         public static Matrix4x4 GetNativeViewProjection(this Camera camera)
         {
             return GL.GetGPUProjectionMatrix(camera.projectionMatrix, false) * camera.worldToCameraMatrix;
@@ -18,6 +18,8 @@ namespace Voxulkan
     {
         public float tessellationFactor = 1.0f;
         public float LODThreshold = 100.0f;
+        [Tooltip("Optional, occlusion culling stays off unless a texture is assigned. Single channel float texture the user fills with the previous frame's reversed Z depth. It is used without reprojection, so chunks uncovered by fast camera motion can appear a frame late")]
+        public RenderTexture occlusionDepth;
 
         IntPtr handle;
         Entity entity;
@@ -40,6 +42,8 @@ namespace Voxulkan
         static extern IntPtr CreateCameraHandle(IntPtr instance);
         [DllImport(Native.DLL)]
         static extern void SetCameraView(IntPtr camera, CameraView constants);
+        [DllImport(Native.DLL)]
+        static extern void SetCameraDepthSource(IntPtr camera, IntPtr nativeTexture);
 
         void Awake()
         {
@@ -48,7 +52,8 @@ namespace Voxulkan
             commandBuffer = new CommandBuffer();
             commandBuffer.name = "NativeSceneInjection";
             handle = CreateCameraHandle(NativeSystem.Active.NativeInstance);
-            commandBuffer.IssuePluginEventAndData(GetRenderInjection(), 1, handle);
+            commandBuffer.IssuePluginEventAndData(GetRenderInjection(), 2, handle);//Cull, outside of the render pass
+            commandBuffer.IssuePluginEventAndData(GetRenderInjection(), 1, handle);//Draw
         }
 
         void LateUpdate()
@@ -59,6 +64,7 @@ namespace Voxulkan
             constants.cameraPos = transform.position;
             constants.tessellationFactor = tessellationFactor;
             SetCameraView(handle, constants);
+            SetCameraDepthSource(handle, occlusionDepth != null && occlusionDepth.IsCreated() ? occlusionDepth.GetNativeTexturePtr() : IntPtr.Zero);
         }
 
         void OnEnable()
@@ -4,6 +4,7 @@ using System.Collections.Generic;
 using Unity.Collections.LowLevel.Unsafe;
 using Unity.Entities;
 using Unity.Jobs;
+using Unity.Jobs.LowLevel.Unsafe;
 using UnityEngine;
 
 namespace Voxulkan
@@ -41,8 +42,15 @@ namespace Voxulkan
             byte[] surfaceAnalysis = Native.LoadShaderBytes("SurfaceAnalysis.comp");
             byte[] surfaceAssembly = Native.LoadShaderBytes("SurfaceAssembly.comp");
             Native.SetComputeShaders(m_nativeInstance, surfaceAnalysis, surfaceAnalysis.Length, surfaceAssembly, surfaceAssembly.Length);
+            //Chunks are culled on the CPU until the cull shaders are compiled
+            byte[] chunkCull = Native.TryLoadShaderBytes("ChunkCull.comp");
+            byte[] depthPyramid = Native.TryLoadShaderBytes("DepthPyramid.comp");
+            if (chunkCull != null && depthPyramid != null)
+                Native.SetCullShaders(m_nativeInstance, chunkCull, chunkCull.Length, depthPyramid, depthPyramid.Length);
 
             Resources.Load<VoxelMaterialDatabase>("Voxel Materials").SetInstanceResources(m_nativeInstance);
+            //Bodies are traversed on job workers, the native task pool sizes itself around them
+            Native.SetJobWorkerCount(m_nativeInstance, (uint)JobsUtility.JobWorkerCount);
 
             Native.InitializeVoxulkanInstance(m_nativeInstance);
             m_queueCount = Native.GetQueueCount(m_nativeInstance);
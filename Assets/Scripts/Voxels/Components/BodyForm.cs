@@ -10,4 +10,8 @@ public struct BodyForm : IBufferElementData
     public Vector3 min;
     public Vector3 max;
     public IntPtr formCompute;
+    //Optional surface bound in body space, see BodyForm in VoxelChunk.h. shellOuter <= shellInner gives no bound.
+    public Vector3 shellCenter;
+    public float shellInner;
+    public float shellOuter;
 }
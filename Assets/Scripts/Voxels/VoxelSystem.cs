@@ -111,6 +111,8 @@ namespace Voxulkan
             forms[0].formCompute = m_sphereForm;
             forms[0].min = -Vector3.one * -900;
             forms[0].max = Vector3.one * 900;
+            forms[0].shellInner = 740;//SphereForm.comp: radius 800, noise moves the surface by at most 50
+            forms[0].shellOuter = 860;
             CreateVoxelBody(Vector3.one * -900, Vector3.one * 900, Vector3.forward * 1000.0f, Quaternion.Euler(50, 12, 42), forms);
             CreateVoxelBody(Vector3.one * -900, Vector3.one * 900, Vector3.back * 1000.0f, Quaternion.Euler(-25, 25, 10), forms);
             CreateVoxelBody(Vector3.one * -900, Vector3.one * 900, Vector3.left * 1000.0f, Quaternion.Euler(50, 12, 42), forms);
@@ -0,0 +1,146 @@
+#include "..//Components/VoxelChunk.h"
+#include "..//Components/ChunkBounds.h"
+#include "..//Containers/DistanceOrder.h"
+#include "glm/gtc/matrix_transform.hpp"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <random>
+
+//Frustum culling and front to back ordering of one body's render list as done by Engine::QueryOcclusion.
+//Args: chunk count.
+
+static const float SCENE_EXTENT = 4000.0f;
+
+struct CullScene
+{
+	std::vector<ChunkRenderPackage> chunks;
+	ChunkBounds bounds;
+	glm::mat4x4 mvp;
+	glm::vec3 position;
+};
+
+static CullScene MakeScene(size_t count)
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> place(-SCENE_EXTENT, SCENE_EXTENT);
+	std::uniform_real_distribution<float> size(8.0f, 128.0f);
+
+	CullScene scene;
+	scene.chunks.resize(count);
+	scene.bounds.Resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		ChunkRenderPackage& chunk = scene.chunks[i];
+		chunk.min = glm::vec3(place(rng), place(rng), place(rng));
+		chunk.max = chunk.min + glm::vec3(size(rng));
+		scene.bounds.Set(i, chunk.min, chunk.max);
+	}
+	scene.position = glm::vec3(0.0f, 100.0f, -SCENE_EXTENT);
+	scene.mvp = glm::perspectiveRH_ZO(1.2f, 16.0f / 9.0f, 0.3f, SCENE_EXTENT * 2.0f) *
+		glm::lookAt(scene.position, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	return scene;
+}
+
+static void BM_CullScalar(benchmark::State& state)
+{
+	CullScene scene = MakeScene((size_t)state.range(0));
+	std::vector<uint32_t> visible(scene.chunks.size());
+	std::vector<float> distances(scene.chunks.size());
+	for (auto _ : state)
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < scene.chunks.size(); i++)
+		{
+			const ChunkRenderPackage& chunk = scene.chunks[i];
+			if (ChunkRenderPackage::FrustumTest(scene.mvp, chunk.min, chunk.max))
+			{
+				glm::vec3 delta = scene.position - glm::clamp(scene.position, chunk.min, chunk.max);
+				distances[i] = delta.x * delta.x + delta.y * delta.y + delta.z * delta.z;
+				visible[count++] = (uint32_t)i;
+			}
+		}
+		benchmark::DoNotOptimize(count);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_CullBatched(benchmark::State& state)
+{
+	CullScene scene = MakeScene((size_t)state.range(0));
+	std::vector<uint32_t> visible(scene.bounds.Size());
+	std::vector<float> distances(scene.bounds.PaddedSize());
+	for (auto _ : state)
+	{
+		size_t count = scene.bounds.Cull(scene.mvp, scene.position, visible.data(), distances.data());
+		benchmark::DoNotOptimize(count);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+//Visible chunks ordered by distance, a full comparison sort against the radix sort on coarse distance keys
+static void BM_OrderSort(benchmark::State& state)
+{
+	CullScene scene = MakeScene((size_t)state.range(0));
+	std::vector<uint32_t> visible(scene.bounds.Size());
+	std::vector<float> distances(scene.bounds.PaddedSize());
+	size_t count = scene.bounds.Cull(scene.mvp, scene.position, visible.data(), distances.data());
+	std::vector<ChunkRenderPackage> chunks(count);
+	for (auto _ : state)
+	{
+		for (size_t k = 0; k < count; k++)
+		{
+			chunks[k] = scene.chunks[visible[k]];
+			chunks[k].distance = distances[visible[k]];
+		}
+		std::sort(chunks.begin(), chunks.end());
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * count);
+}
+
+static void BM_OrderRadix(benchmark::State& state)
+{
+	CullScene scene = MakeScene((size_t)state.range(0));
+	std::vector<uint32_t> visible(scene.bounds.Size());
+	std::vector<float> distances(scene.bounds.PaddedSize());
+	size_t count = scene.bounds.Cull(scene.mvp, scene.position, visible.data(), distances.data());
+	std::vector<uint32_t> order(count);
+	std::vector<uint32_t> scratch;
+	std::vector<ChunkRenderPackage> chunks(count);
+	for (auto _ : state)
+	{
+		order.assign(visible.begin(), visible.begin() + count);
+		SortByDistance(distances.data(), order.data(), count, scratch);
+		for (size_t k = 0; k < count; k++)
+		{
+			chunks[k] = scene.chunks[order[k]];
+			chunks[k].distance = distances[order[k]];
+		}
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * count);
+}
+
+BENCHMARK(BM_CullScalar)
+	->ArgNames({ "chunks" })
+	->RangeMultiplier(8)->Range(64, 32768)
+	->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_CullBatched)
+	->ArgNames({ "chunks" })
+	->RangeMultiplier(8)->Range(64, 32768)
+	->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_OrderSort)
+	->ArgNames({ "chunks" })
+	->RangeMultiplier(8)->Range(512, 262144)
+	->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_OrderRadix)
+	->ArgNames({ "chunks" })
+	->RangeMultiplier(8)->Range(512, 262144)
+	->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
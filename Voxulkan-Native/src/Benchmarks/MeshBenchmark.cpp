@@ -0,0 +1,83 @@
+#include "..//Components/MeshOptimizer.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+//Vertex cache and fetch reordering of one chunk surface as done by VoxelChunk::OptimizeMesh.
+//The surface is a rolling height field over an n x n cell grid. Like SurfaceAnalysis.comp every cell appends its vertex
+//and its triangles in the order the cells win their atomics, which is modelled as a shuffle.
+//Reports ACMR (transformed vertices per triangle, cache of VERTEX_CACHE_SIZE) of the assembled and the optimized order.
+//Args: cells per side.
+
+struct ChunkSurface
+{
+	std::vector<uint32_t> indices;
+	uint32_t vertexCount;
+};
+
+static ChunkSurface MakeSurface(uint32_t cells)
+{
+	uint32_t side = cells + 1;
+	std::mt19937 rng(11);
+
+	std::vector<uint32_t> cellOrder(side * side);
+	std::iota(cellOrder.begin(), cellOrder.end(), 0U);
+	std::shuffle(cellOrder.begin(), cellOrder.end(), rng);
+
+	//Vertex of corner c is numbered when its cell is reached
+	std::vector<uint32_t> vertexOf(side * side);
+	for (uint32_t i = 0; i < cellOrder.size(); i++)
+		vertexOf[cellOrder[i]] = i;
+
+	ChunkSurface surface;
+	surface.vertexCount = side * side;
+	surface.indices.reserve((size_t)cells * cells * 6);
+	for (uint32_t c : cellOrder)
+	{
+		uint32_t x = c % side;
+		uint32_t y = c / side;
+		if (x == cells || y == cells)//Border cells only carry vertices
+			continue;
+		uint32_t v00 = vertexOf[c];
+		uint32_t v10 = vertexOf[c + 1];
+		uint32_t v01 = vertexOf[c + side];
+		uint32_t v11 = vertexOf[c + side + 1];
+		bool flip = std::sin(x * 0.37f) + std::cos(y * 0.29f) > 0.0f;//Diagonal follows the surface like the marching cubes cases do
+		if (flip)
+		{
+			surface.indices.insert(surface.indices.end(), { v00, v01, v10, v10, v01, v11 });
+		}
+		else
+		{
+			surface.indices.insert(surface.indices.end(), { v00, v01, v11, v00, v11, v10 });
+		}
+	}
+	return surface;
+}
+
+static void BM_MeshOptimize(benchmark::State& state)
+{
+	ChunkSurface surface = MakeSurface((uint32_t)state.range(0));
+	std::vector<uint32_t> indices(surface.indices.size());
+	std::vector<uint32_t> remap;
+	MeshOptimizer optimizer;
+	for (auto _ : state)
+	{
+		indices = surface.indices;
+		optimizer.OptimizeVertexCache(indices.data(), indices.size(), surface.vertexCount);
+		optimizer.OptimizeVertexFetch(indices.data(), indices.size(), surface.vertexCount, remap);
+		benchmark::ClobberMemory();
+	}
+	state.counters["acmr_before"] = ComputeACMR(surface.indices.data(), surface.indices.size(), surface.vertexCount);
+	state.counters["acmr_after"] = ComputeACMR(indices.data(), indices.size(), surface.vertexCount);
+	state.SetItemsProcessed(state.iterations() * (surface.indices.size() / 3));
+}
+
+BENCHMARK(BM_MeshOptimize)
+	->ArgNames({ "cells" })
+	->Arg(16)->Arg(31)->Arg(64)
+	->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,180 @@
+#include "..//Components/VoxelBody.h"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+//Drives VoxelBody::TraverseTree with the GPU build step mocked out.
+//Args: body extent, maxDepth, error threshold E, observer path.
+
+static std::atomic<uint64_t> s_allocations(0);
+
+void* operator new(std::size_t size)
+{
+	s_allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	free(p);
+}
+
+typedef enum ObserverPath
+{
+	OBSERVER_PATH_FLY_THROUGH = 0,
+	OBSERVER_PATH_ORBIT = 1,
+	OBSERVER_PATH_TELEPORT = 2,
+	OBSERVER_PATH_HOVER = 3,
+} ObserverPath;
+
+static const uint32_t PATH_FRAMES = 600;
+static const uint32_t BUILDS_PER_FRAME = 50; //Matches the staging pool size in Engine::InitializeResources
+
+//Not a live allocation, RenderChunk only checks the handles are present
+static GPUBufferHandle s_mockVertexBuffer;
+static GPUBufferHandle s_mockIndexBuffer;
+
+struct MockBuilder
+{
+	std::atomic<int32_t> budget = { 0 };
+};
+
+static bool MockBuild(VoxelChunk& chunk, void* userData)
+{
+	MockBuilder* builder = static_cast<MockBuilder*>(userData);
+	if (builder->budget.fetch_sub(1, std::memory_order_relaxed) <= 0)
+		return false;
+
+	chunk.m_vertexBuffer.m_gpuHandle = &s_mockVertexBuffer;
+	chunk.m_indexBuffer.m_gpuHandle = &s_mockIndexBuffer;
+	chunk.m_indexCount = 3;
+	chunk.m_vertexCount = 3;
+	return true;
+}
+
+static glm::vec3 ObserverAt(ObserverPath path, uint32_t frame, float extent)
+{
+	float t = (float)(frame % PATH_FRAMES) / (float)PATH_FRAMES;
+	switch (path)
+	{
+	case OBSERVER_PATH_FLY_THROUGH:
+		return glm::vec3(-extent * 1.5f + t * extent * 3.0f, extent * 0.1f, extent * 0.05f);
+	case OBSERVER_PATH_ORBIT:
+	{
+		float a = t * 6.28318530718f;
+		return glm::vec3(std::cos(a), 0.2f, std::sin(a)) * (extent * 0.75f);
+	}
+	case OBSERVER_PATH_HOVER:
+	{
+		//Slow drift near the surface, most of the tree settles
+		float a = t * 6.28318530718f;
+		return glm::vec3(std::cos(a), 0.0f, std::sin(a)) * (extent * 0.01f) + glm::vec3(0.0f, extent * 0.1f, 0.0f);
+	}
+	case OBSERVER_PATH_TELEPORT:
+	default:
+	{
+		//Deterministic jump every 30 frames
+		uint32_t h = (frame / 30) * 2654435761U;
+		glm::vec3 r((h & 0x3FF) / 1023.0f, ((h >> 10) & 0x3FF) / 1023.0f, ((h >> 20) & 0x3FF) / 1023.0f);
+		return (r * 2.0f - 1.0f) * extent;
+	}
+	}
+}
+
+static void RunTraverse(benchmark::State& state, float extent, uint32_t maxDepth, float E, ObserverPath path, TaskScheduler* scheduler, uint32_t parallelDepth, bool incremental = false)
+{
+	VoxelBody body(glm::vec3(-extent), glm::vec3(extent));
+	std::vector<GPUResourceHandle*> trash;
+	MockBuilder builder;
+
+	uint64_t frames = 0;
+	uint64_t visited = 0;
+	uint64_t reused = 0;
+	uint64_t allocations = 0;
+	for (auto _ : state)
+	{
+		builder.budget = BUILDS_PER_FRAME;
+		TraverseContext context = {};
+		context.trash = &trash;
+		context.observerPosition = ObserverAt(path, (uint32_t)frames, extent);
+		context.E = E;
+		context.maxDepth = maxDepth;
+		context.scheduler = scheduler;
+		context.parallelDepth = parallelDepth;
+		context.incremental = incremental;
+		context.buildOverride = MockBuild;
+		context.buildUserData = &builder;
+
+		uint64_t allocStart = s_allocations.load(std::memory_order_relaxed);
+		body.TraverseTree(context);
+		allocations += s_allocations.load(std::memory_order_relaxed) - allocStart;
+		benchmark::DoNotOptimize(context.render.data());
+
+		trash.clear();
+		visited += context.stats.visitedNodes;
+		reused += context.stats.reusedSubtrees;
+		frames++;
+	}
+
+	state.counters["nodes/frame"] = benchmark::Counter((double)visited / (double)frames);
+	state.counters["reused/frame"] = benchmark::Counter((double)reused / (double)frames);
+	state.counters["allocs/frame"] = benchmark::Counter((double)allocations / (double)frames);
+	//Reported in seconds per node, the console reporter prints it with an SI prefix (e.g. 12.3n)
+	state.counters["time/node"] = benchmark::Counter((double)visited, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+static void BM_Traverse(benchmark::State& state)
+{
+	RunTraverse(state, (float)state.range(0), (uint32_t)state.range(1), (float)state.range(2), (ObserverPath)state.range(3), nullptr, 0);
+}
+
+//Single body split into subtree tasks, threads is the scheduler's worker count (the caller helps too)
+static void BM_TraverseParallel(benchmark::State& state)
+{
+	TaskScheduler scheduler((uint32_t)state.range(1));
+	RunTraverse(state, 16000.0f, 10, 1.0f, (ObserverPath)state.range(0), &scheduler, (uint32_t)state.range(2));
+}
+
+//Full walk against reusing settled subtrees, same body and path
+static void BM_TraverseIncremental(benchmark::State& state)
+{
+	RunTraverse(state, 16000.0f, 10, (float)state.range(1), (ObserverPath)state.range(0), nullptr, 0, state.range(2) != 0);
+}
+
+BENCHMARK(BM_Traverse)
+	->ArgNames({ "extent", "maxDepth", "E", "path" })
+	->ArgsProduct({
+		{ 1000, 4000, 16000 },
+		{ 6, 8, 10 },
+		{ 1, 10, 100 },
+		{ OBSERVER_PATH_FLY_THROUGH, OBSERVER_PATH_ORBIT, OBSERVER_PATH_TELEPORT } })
+	->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_TraverseParallel)
+	->ArgNames({ "path", "threads", "parallelDepth" })
+	->ArgsProduct({
+		{ OBSERVER_PATH_FLY_THROUGH, OBSERVER_PATH_ORBIT, OBSERVER_PATH_TELEPORT },
+		{ 0, 1, 3, 7 },
+		{ 1, 2, 3 } })
+	->Unit(benchmark::kMicrosecond)
+	->UseRealTime();
+
+BENCHMARK(BM_TraverseIncremental)
+	->ArgNames({ "path", "E", "incremental" })
+	->ArgsProduct({
+		{ OBSERVER_PATH_FLY_THROUGH, OBSERVER_PATH_ORBIT, OBSERVER_PATH_TELEPORT, OBSERVER_PATH_HOVER },
+		{ 1, 10 },
+		{ 0, 1 } })
+	->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -16,6 +16,18 @@ Camera::Camera(Engine* instance) : m_instance(instance)
 
 }
 
+EXPORT void SetCameraDepthSource(Camera* camera, void* nativeTexture)
+{
+	camera->m_depthSource = nativeTexture;
+}
+
 void Camera::Deallocate(Engine* instance)
 {
+	//Collected itself, its images are past any frame in flight as well
+	if (m_depthPyramid.m_gpuHandle)
+		m_depthPyramid.m_gpuHandle->Deallocate(instance);
+	SAFE_DEL(m_depthPyramid.m_gpuHandle);
+	if (m_depthSourceView)
+		m_depthSourceView->Deallocate(instance);
+	SAFE_DEL(m_depthSourceView);
 }
@@ -2,7 +2,8 @@
 #include <atomic>
 #include "glm/glm.hpp"
 #include "Components/VoxelBody.h"
-#include "Containers/MutexList.h"
+#include "Containers/TripleBuffer.h"
+#include "Resources/GPUImage.h"
 
 class Engine;
 
@@ -13,6 +14,37 @@ struct CameraView
 	float tessellationFactor = 0.0f;
 };
 
+//Consecutive chunks of one body sharing mesh buffers, drawn with a single indirect draw
+typedef struct DrawRun
+{
+	uint32_t body;
+	VkBuffer vertexBuffer;
+	VkBuffer indexBuffer;
+	VkIndexType indexType;
+	uint32_t first;
+	uint32_t count;
+} DrawRun;
+
+//Body of a published frame as seen by one camera, its visible chunks are the packet's chunk indices [first, first + count) front to back
+typedef struct BodyView
+{
+	const BodyRenderPackage* body;
+	uint32_t firstChunk;
+	uint32_t chunkCount;
+	float distance;
+} BodyView;
+
+//What one camera draws of a frame, bodies front to back.
+//Draw records are built by the occlusion query so the render thread only uploads them and issues one draw per run.
+typedef struct CameraPacket
+{
+	std::vector<BodyView> bodies = {};//Only bodies with visible chunks
+	std::vector<uint32_t> chunks = {};
+	std::vector<DrawRun> runs = {};//Body indices into bodies
+	std::vector<VkDrawIndexedIndirectCommand> commands = {};//One per chunk in run order
+	std::vector<ChunkCullRecord> records = {};//Parallel to commands, only built when chunks are culled on the GPU
+} CameraPacket;
+
 class Camera : GPUResourceHandle
 {
 public:
@@ -24,9 +56,28 @@ public:
 
 	Engine* m_instance = nullptr;
 	VkQueryPool m_occlusionQuery = VK_NULL_HANDLE;
-	MutexList<BodyRenderPackage> m_renderPackage = {};
+	CameraPacket m_packets[TRIPLE_BUFFER_SLOTS] = {};//Parallel to the engine's render frames
+	std::vector<float> m_orderDistances = {};//Scratch of the occlusion query ordering the packets
+	std::vector<uint32_t> m_orderIndices = {};
+	std::vector<uint32_t> m_orderScratch = {};
+	std::vector<BodyView> m_orderBodies = {};
 	
 	volatile CameraView m_view = {};
 	
 	const VkDeviceSize QUERY_SIZE = 1000;
+
+	//GPU culling, recorded by the cull event and consumed by the following draw of the same frame
+	void* m_depthSource = nullptr;//Native texture holding last frame's reversed Z depth, set from script. Optional and used as is, without reprojection
+	VkImage m_depthSourceImage = VK_NULL_HANDLE;
+	GPUImageHandle* m_depthSourceView = nullptr;
+	GPUImage m_depthPyramid = {};
+	glm::uvec2 m_pyramidSize = {};//Level 0, the pyramid image is wider to hold the smaller levels
+	uint32_t m_pyramidLevels = 0;
+
+	unsigned long long m_culledFrame = ~0ULL;
+	std::vector<glm::mat4x4> m_culledTransforms = {};
+	std::vector<DrawRun> m_culledRuns = {};
+	VkBuffer m_culledCommands = VK_NULL_HANDLE;
+	VkDeviceSize m_culledCommandOffset = 0;
+	VkDeviceSize m_culledCountOffset = 0;
 };
\ No newline at end of file
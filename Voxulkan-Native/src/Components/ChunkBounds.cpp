@@ -0,0 +1,138 @@
+#include "ChunkBounds.h"
+#include "glm/gtc/matrix_access.hpp"
+#include <cmath>
+
+//Widest instruction set the build targets, every path runs the same kernel on a batch of LANES boxes
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LANES 8
+typedef __m256 Lanes;
+static inline Lanes Load(const float* p) { return _mm256_loadu_ps(p); }
+static inline void Store(float* p, Lanes a) { _mm256_storeu_ps(p, a); }
+static inline Lanes Splat(float v) { return _mm256_set1_ps(v); }
+static inline Lanes Add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+static inline Lanes Sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+static inline Lanes Mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+static inline Lanes Min(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+static inline Lanes Max(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+static inline uint32_t Negative(Lanes a) { return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_LT_OQ)); }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LANES 4
+typedef __m128 Lanes;
+static inline Lanes Load(const float* p) { return _mm_loadu_ps(p); }
+static inline void Store(float* p, Lanes a) { _mm_storeu_ps(p, a); }
+static inline Lanes Splat(float v) { return _mm_set1_ps(v); }
+static inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes Sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes Min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+static inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+static inline uint32_t Negative(Lanes a) { return (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(a, _mm_setzero_ps())); }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define LANES 4
+typedef float32x4_t Lanes;
+static inline Lanes Load(const float* p) { return vld1q_f32(p); }
+static inline void Store(float* p, Lanes a) { vst1q_f32(p, a); }
+static inline Lanes Splat(float v) { return vdupq_n_f32(v); }
+static inline Lanes Add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+static inline Lanes Sub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+static inline Lanes Mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+static inline Lanes Min(Lanes a, Lanes b) { return vminq_f32(a, b); }
+static inline Lanes Max(Lanes a, Lanes b) { return vmaxq_f32(a, b); }
+static inline uint32_t Negative(Lanes a)
+{
+	static const uint32_t bits[4] = { 1, 2, 4, 8 };
+	return vaddvq_u32(vandq_u32(vcltq_f32(a, vdupq_n_f32(0.0f)), vld1q_u32(bits)));
+}
+#else
+#define LANES 1
+typedef float Lanes;
+static inline Lanes Load(const float* p) { return *p; }
+static inline void Store(float* p, Lanes a) { *p = a; }
+static inline Lanes Splat(float v) { return v; }
+static inline Lanes Add(Lanes a, Lanes b) { return a + b; }
+static inline Lanes Sub(Lanes a, Lanes b) { return a - b; }
+static inline Lanes Mul(Lanes a, Lanes b) { return a * b; }
+static inline Lanes Min(Lanes a, Lanes b) { return a < b ? a : b; }
+static inline Lanes Max(Lanes a, Lanes b) { return a > b ? a : b; }
+static inline uint32_t Negative(Lanes a) { return a < 0.0f ? 1 : 0; }
+#endif
+
+static_assert(CHUNK_BOUNDS_PADDING % LANES == 0, "Chunk bounds padding must cover the kernel width");
+
+void ChunkBounds::Resize(size_t count)
+{
+	size_t padded = (count + CHUNK_BOUNDS_PADDING - 1) / CHUNK_BOUNDS_PADDING * CHUNK_BOUNDS_PADDING;
+	m_count = count;
+	m_minX.resize(padded); m_minY.resize(padded); m_minZ.resize(padded);
+	m_maxX.resize(padded); m_maxY.resize(padded); m_maxZ.resize(padded);
+}
+
+void ChunkBounds::Clear()
+{
+	Resize(0);
+}
+
+size_t ChunkBounds::Cull(const glm::mat4x4& mvp, const glm::vec3& localPosition, uint32_t* visible, float* distances) const
+{
+	//Clip planes in local space, a box is outside once its corner furthest along the plane normal is behind it.
+	//Same result as ChunkRenderPackage::FrustumTest without transforming the eight corners.
+	glm::vec4 rows[4] = { glm::row(mvp, 0), glm::row(mvp, 1), glm::row(mvp, 2), glm::row(mvp, 3) };
+	glm::vec4 planes[6] = {
+		rows[3] + rows[0],//Left
+		rows[3] - rows[0],//Right
+		rows[3] + rows[1],//Bottom
+		rows[3] - rows[1],//Top
+		rows[2],//Near
+		rows[3] - rows[2],//Far
+	};
+	Lanes planeN[6][3];
+	Lanes planeA[6][3];
+	Lanes planeD[6];
+	for (int p = 0; p < 6; p++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			planeN[p][k] = Splat(planes[p][k]);
+			planeA[p][k] = Splat(std::abs(planes[p][k]));
+		}
+		planeD[p] = Splat(planes[p].w);
+	}
+
+	const Lanes half = Splat(0.5f);
+	const Lanes px = Splat(localPosition.x);
+	const Lanes py = Splat(localPosition.y);
+	const Lanes pz = Splat(localPosition.z);
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < m_count; i += LANES)
+	{
+		Lanes minX = Load(&m_minX[i]), minY = Load(&m_minY[i]), minZ = Load(&m_minZ[i]);
+		Lanes maxX = Load(&m_maxX[i]), maxY = Load(&m_maxY[i]), maxZ = Load(&m_maxZ[i]);
+
+		Lanes cx = Mul(Add(minX, maxX), half), cy = Mul(Add(minY, maxY), half), cz = Mul(Add(minZ, maxZ), half);
+		Lanes ex = Mul(Sub(maxX, minX), half), ey = Mul(Sub(maxY, minY), half), ez = Mul(Sub(maxZ, minZ), half);
+		uint32_t outside = 0;
+		for (int p = 0; p < 6; p++)
+		{
+			Lanes d = Add(Add(Mul(planeN[p][0], cx), Mul(planeN[p][1], cy)), Add(Mul(planeN[p][2], cz), planeD[p]));
+			Lanes r = Add(Add(Mul(planeA[p][0], ex), Mul(planeA[p][1], ey)), Mul(planeA[p][2], ez));
+			outside |= Negative(Add(d, r));
+		}
+
+		//Squared distance to the closest point of the box
+		Lanes dx = Sub(px, Min(Max(px, minX), maxX));
+		Lanes dy = Sub(py, Min(Max(py, minY), maxY));
+		Lanes dz = Sub(pz, Min(Max(pz, minZ), maxZ));
+		Store(distances + i, Add(Add(Mul(dx, dx), Mul(dy, dy)), Mul(dz, dz)));
+
+		size_t lanes = m_count - i < LANES ? m_count - i : LANES;
+		for (size_t l = 0; l < lanes; l++)
+		{
+			if ((outside & (1U << l)) == 0)
+				visible[visibleCount++] = (uint32_t)(i + l);
+		}
+	}
+	return visibleCount;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <vector>
+
+#define CHUNK_BOUNDS_PADDING 8 //Widest culling kernel, arrays are padded so every batch loads whole
+
+//Chunk boxes of a render list in structure of arrays form, index i matches the i-th chunk
+class ChunkBounds
+{
+public:
+	void Resize(size_t count);
+	void Clear();
+	inline size_t Size() const { return m_count; }
+	inline void Set(size_t i, const glm::vec3& min, const glm::vec3& max)
+	{
+		m_minX[i] = min.x; m_minY[i] = min.y; m_minZ[i] = min.z;
+		m_maxX[i] = max.x; m_maxY[i] = max.y; m_maxZ[i] = max.z;
+	}
+
+	//Tests every box against the frustum of mvp, a Vulkan clip space with z in [0,w].
+	//Writes the indices of boxes inside or crossing the frustum and returns their count,
+	//distances receives the squared distance of every box to localPosition and must hold PaddedSize() floats.
+	size_t Cull(const glm::mat4x4& mvp, const glm::vec3& localPosition, uint32_t* visible, float* distances) const;
+	inline size_t PaddedSize() const { return m_minX.size(); }
+
+private:
+	size_t m_count = 0;
+	std::vector<float> m_minX, m_minY, m_minZ;
+	std::vector<float> m_maxX, m_maxY, m_maxZ;
+};
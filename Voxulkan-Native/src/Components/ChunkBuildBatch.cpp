@@ -0,0 +1,360 @@
+#include "ChunkBuildBatch.h"
+#include "..//Engine.h"
+#include "..//Plugin.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+void ChunkBuildBatch::AddLayoutTransition(const VkImageMemoryBarrier& colorBarrier, const VkImageMemoryBarrier& indexBarrier)
+{
+	m_layoutBarriers.push_back(colorBarrier);
+	m_layoutBarriers.push_back(indexBarrier);
+}
+
+void ChunkBuildBatch::AddForm(ChunkStagingResources* staging, uint32_t formIndex, ComputePipeline* formCompute, const FormConstants& constants)
+{
+	FormDispatch dispatch;
+	dispatch.staging = staging;
+	dispatch.formIndex = formIndex;
+	dispatch.formCompute = formCompute;
+	dispatch.constants = constants;
+	m_forms.push_back(dispatch);
+}
+
+void ChunkBuildBatch::AddAnalysis(ChunkStagingResources* staging, const SurfaceAnalysisConstants& constants)
+{
+	AnalysisDispatch dispatch;
+	dispatch.staging = staging;
+	dispatch.constants = constants;
+	m_analysis.push_back(dispatch);
+}
+
+void ChunkBuildBatch::AddAssembly(ChunkStagingResources* staging, const SurfaceAssemblyConstants& constants, uint32_t cellCount)
+{
+	AssemblyDispatch dispatch;
+	dispatch.staging = staging;
+	dispatch.constants = constants;
+	dispatch.cellCount = cellCount;
+	m_assembly.push_back(dispatch);
+}
+
+void ChunkBuildBatch::AddIndirectAssembly(ChunkStagingResources* staging, const SurfaceAssemblyConstants& constants)
+{
+	AssemblyDispatch dispatch;
+	dispatch.staging = staging;
+	dispatch.constants = constants;
+	dispatch.indirect = true;
+	m_assembly.push_back(dispatch);
+}
+
+void ChunkBuildBatch::AddMeshReadback(ChunkStagingResources* staging)
+{
+	m_meshReadbacks.push_back(staging);
+}
+
+void ChunkBuildBatch::AddMeshUpload(ChunkStagingResources* staging)
+{
+	m_meshUploads.push_back(staging);
+}
+
+void ChunkBuildBatch::Record(Engine* instance, VkCommandBuffer commandBuffer)
+{
+	if (!m_layoutBarriers.empty())
+	{
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			static_cast<uint32_t>(m_layoutBarriers.size()), m_layoutBarriers.data());
+	}
+
+	if (!m_meshReadbacks.empty() || !m_meshUploads.empty())
+		RecordMeshTransfers(instance, commandBuffer);
+	if (!m_analysis.empty())
+		RecordVolumes(instance, commandBuffer);
+	if (!m_assembly.empty())
+		RecordAssemblies(instance, commandBuffer);
+	if (!m_analysis.empty())//Counts are read back once the speculative assembly is done as well
+		RecordReadback(commandBuffer);
+
+	m_layoutBarriers.clear();
+	m_forms.clear();
+	m_analysis.clear();
+	m_assembly.clear();
+	m_meshReadbacks.clear();
+	m_meshUploads.clear();
+}
+
+void ChunkBuildBatch::RecordVolumes(Engine* instance, VkCommandBuffer commandBuffer)
+{
+	//Later forms write over earlier ones, every chunk finishes a form before any starts the next
+	std::stable_sort(m_forms.begin(), m_forms.end(), [](const FormDispatch& a, const FormDispatch& b) { return a.formIndex < b.formIndex; });
+
+	VkMemoryBarrier memB = {};
+	memB.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memB.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memB.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+	ComputePipeline* boundForm = nullptr;
+	VkPipeline formPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout formLayout = VK_NULL_HANDLE;
+	for (size_t i = 0; i < m_forms.size(); i++)
+	{
+		const FormDispatch& dispatch = m_forms[i];
+		if (i > 0 && dispatch.formIndex != m_forms[i - 1].formIndex)
+		{
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0,
+				1, &memB,
+				0, nullptr,
+				0, nullptr);
+		}
+
+		if (dispatch.formCompute != boundForm)
+		{
+			boundForm = dispatch.formCompute;
+			boundForm->GetVkPipeline(formPipeline, formLayout);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, formPipeline);
+		}
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, formLayout, 0, 1, &dispatch.staging->m_formDSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, formLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FormConstants), &dispatch.constants);
+		vkCmdDispatch(commandBuffer,
+			(uint32_t)std::ceil(dispatch.constants.range.x / 4.0f),
+			(uint32_t)std::ceil(dispatch.constants.range.y / 4.0f),
+			(uint32_t)std::ceil(dispatch.constants.range.z / 4.0f));
+	}
+
+	for (const AnalysisDispatch& dispatch : m_analysis)
+	{
+		VkBuffer info = dispatch.staging->m_info.m_gpuHandle->m_buffer;
+		vkCmdFillBuffer(commandBuffer, info, 0, 24, 0);
+		vkCmdFillBuffer(commandBuffer, info, 24, 12, Engine::CHUNK_SIZE);
+		vkCmdFillBuffer(commandBuffer, info, 36, 4, 0);
+		vkCmdFillBuffer(commandBuffer, info, 40, 8, 1);
+		vkCmdFillBuffer(commandBuffer, info, sizeof(SurfaceAnalysisInfo), VK_WHOLE_SIZE, 0);
+	}
+
+	memB.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	memB.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1, &memB,
+		0, nullptr,
+		0, nullptr);
+
+	VkPipeline analysisPipeline;
+	VkPipelineLayout analysisPipelineLayout;
+	instance->m_surfaceAnalysisPipeline.GetVkPipeline(analysisPipeline, analysisPipelineLayout);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, analysisPipeline);
+	for (const AnalysisDispatch& dispatch : m_analysis)
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, analysisPipelineLayout, 0, 1, &dispatch.staging->m_analysisDSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, analysisPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SurfaceAnalysisConstants), &dispatch.constants);
+		vkCmdDispatch(commandBuffer,
+			(uint32_t)std::ceil((dispatch.constants.range.x + 1) / 4.0f),
+			(uint32_t)std::ceil((dispatch.constants.range.y + 1) / 4.0f),
+			(uint32_t)std::ceil((dispatch.constants.range.z + 1) / 4.0f));
+	}
+
+	memB.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memB.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		1, &memB,
+		0, nullptr,
+		0, nullptr);
+}
+
+void ChunkBuildBatch::RecordReadback(VkCommandBuffer commandBuffer)
+{
+	VkBufferCopy attribCopy = {};
+	attribCopy.size = sizeof(SurfaceAnalysisInfo);
+	attribCopy.dstOffset = 0;
+	attribCopy.srcOffset = 0;
+	for (const AnalysisDispatch& dispatch : m_analysis)
+		vkCmdCopyBuffer(commandBuffer, dispatch.staging->m_info.m_gpuHandle->m_buffer, dispatch.staging->m_infoStaging.m_gpuHandle->m_buffer, 1, &attribCopy);
+
+	VkMemoryBarrier memB = {};
+	memB.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memB.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memB.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1, &memB,
+		0, nullptr,
+		0, nullptr);
+
+	for (const AnalysisDispatch& dispatch : m_analysis)
+		vkCmdSetEvent(commandBuffer, dispatch.staging->m_analysisCompleteEvent, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+
+//Region of a mesh in its host copy, vertices first and indices behind them
+static void MeshStagingCopies(const ChunkStagingResources* staging, VkBufferCopy& vertexCopy, VkBufferCopy& indexCopy)
+{
+	vertexCopy.srcOffset = staging->m_verticies.m_gpuHandle->m_offset;
+	vertexCopy.dstOffset = 0;
+	vertexCopy.size = staging->m_verticies.m_byteCount;
+	indexCopy.srcOffset = staging->m_indicies.m_gpuHandle->m_offset;
+	indexCopy.dstOffset = vertexCopy.size;
+	indexCopy.size = IndexRange(staging->m_indicies.m_byteCount);
+}
+
+void ChunkBuildBatch::RecordMeshTransfers(Engine* instance, VkCommandBuffer commandBuffer)
+{
+	//Assemblies of earlier submissions wrote the ranges read back here
+	VkMemoryBarrier memB = {};
+	memB.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memB.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memB.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		1, &memB,
+		0, nullptr,
+		0, nullptr);
+
+	VkBufferCopy vertexCopy = {};
+	VkBufferCopy indexCopy = {};
+	for (ChunkStagingResources* staging : m_meshReadbacks)
+	{
+		VkBuffer meshStaging = staging->m_meshStaging.m_gpuHandle->m_buffer;
+		MeshStagingCopies(staging, vertexCopy, indexCopy);
+		vkCmdCopyBuffer(commandBuffer, staging->m_verticies.m_gpuHandle->m_buffer, meshStaging, 1, &vertexCopy);
+		vkCmdCopyBuffer(commandBuffer, staging->m_indicies.m_gpuHandle->m_buffer, meshStaging, 1, &indexCopy);
+	}
+
+	//Uploaded meshes move to the graphics queue family like assembled ones
+	VkBufferMemoryBarrier bufferMemB = {};
+	bufferMemB.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	bufferMemB.srcQueueFamilyIndex = instance->m_computeQueueFamily;
+	bufferMemB.dstQueueFamilyIndex = instance->m_instance.queueFamilyIndex;
+	bufferMemB.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	m_bufferBarriers.clear();
+	for (ChunkStagingResources* staging : m_meshUploads)
+	{
+		VkBuffer meshStaging = staging->m_meshStaging.m_gpuHandle->m_buffer;
+		MeshStagingCopies(staging, vertexCopy, indexCopy);
+		std::swap(vertexCopy.srcOffset, vertexCopy.dstOffset);
+		std::swap(indexCopy.srcOffset, indexCopy.dstOffset);
+		vkCmdCopyBuffer(commandBuffer, meshStaging, staging->m_verticies.m_gpuHandle->m_buffer, 1, &vertexCopy);
+		vkCmdCopyBuffer(commandBuffer, meshStaging, staging->m_indicies.m_gpuHandle->m_buffer, 1, &indexCopy);
+
+		bufferMemB.buffer = staging->m_verticies.m_gpuHandle->m_buffer;
+		bufferMemB.offset = vertexCopy.dstOffset;
+		bufferMemB.size = vertexCopy.size;
+		bufferMemB.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		m_bufferBarriers.push_back(bufferMemB);
+		bufferMemB.buffer = staging->m_indicies.m_gpuHandle->m_buffer;
+		bufferMemB.offset = indexCopy.dstOffset;
+		bufferMemB.size = indexCopy.size;
+		bufferMemB.dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
+		m_bufferBarriers.push_back(bufferMemB);
+	}
+
+	memB.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memB.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		0,
+		1, &memB,
+		static_cast<uint32_t>(m_bufferBarriers.size()), m_bufferBarriers.data(),
+		0, nullptr);
+
+	for (ChunkStagingResources* staging : m_meshReadbacks)
+		vkCmdSetEvent(commandBuffer, staging->m_assemblyCompleteEvent, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	for (ChunkStagingResources* staging : m_meshUploads)
+		vkCmdSetEvent(commandBuffer, staging->m_assemblyCompleteEvent, VK_PIPELINE_STAGE_TRANSFER_BIT);
+}
+
+void ChunkBuildBatch::RecordAssemblies(Engine* instance, VkCommandBuffer commandBuffer)
+{
+	//16 bit indices are or'ed into shared words, their ranges start out cleared
+	bool cleared = false;
+	for (const AssemblyDispatch& dispatch : m_assembly)
+	{
+		if (dispatch.constants.vertexCapacity > NARROW_INDEX_VERTEX_LIMIT)
+			continue;
+		const GPUBuffer& indices = dispatch.staging->m_indicies;
+		vkCmdFillBuffer(commandBuffer, indices.m_gpuHandle->m_buffer, indices.m_gpuHandle->m_offset, IndexRange(indices.m_byteCount), 0);
+		cleared = true;
+	}
+	if (cleared)
+	{
+		VkMemoryBarrier fillB = {};
+		fillB.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		fillB.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		fillB.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			1, &fillB,
+			0, nullptr,
+			0, nullptr);
+	}
+
+	VkPipeline assemblyPipeline;
+	VkPipelineLayout assemblyPipelineLayout;
+	instance->m_surfaceAssemblyPipeline.GetVkPipeline(assemblyPipeline, assemblyPipelineLayout);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, assemblyPipeline);
+
+	VkWriteDescriptorSet descWrites[2] = {};
+	descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descWrites[0].descriptorCount = 1;
+	descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descWrites[0].dstArrayElement = 0;
+	descWrites[0].dstBinding = 0;
+	descWrites[1] = descWrites[0];
+	descWrites[1].dstBinding = 1;
+
+	//Mesh buffers move to the graphics queue family once assembled
+	VkBufferMemoryBarrier bufferMemB = {};
+	bufferMemB.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	bufferMemB.srcQueueFamilyIndex = instance->m_computeQueueFamily;
+	bufferMemB.dstQueueFamilyIndex = instance->m_instance.queueFamilyIndex;
+	bufferMemB.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+	m_bufferBarriers.clear();
+	for (const AssemblyDispatch& dispatch : m_assembly)
+	{
+		ChunkStagingResources* staging = dispatch.staging;
+		GPUBufferHandle* vertices = staging->m_verticies.m_gpuHandle;
+		GPUBufferHandle* indices = staging->m_indicies.m_gpuHandle;
+		VkDescriptorBufferInfo vertBI = { vertices->m_buffer, vertices->m_offset, std::max(staging->m_verticies.m_byteCount, (VkDeviceSize)VERTEX_BYTE_SIZE) };
+		VkDescriptorBufferInfo idxsBI = { indices->m_buffer, indices->m_offset, IndexRange(staging->m_indicies.m_byteCount) };
+		descWrites[0].pBufferInfo = &vertBI;
+		descWrites[1].pBufferInfo = &idxsBI;
+
+		vkCmdPushDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, assemblyPipelineLayout, 1, 2, descWrites);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, assemblyPipelineLayout, 0, 1, &staging->m_assemblyDSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, assemblyPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SurfaceAssemblyConstants), &dispatch.constants);
+		if (dispatch.indirect)
+			vkCmdDispatchIndirect(commandBuffer, staging->m_info.m_gpuHandle->m_buffer, offsetof(SurfaceAnalysisInfo, assemblyGroups));
+		else
+			vkCmdDispatch(commandBuffer, (uint32_t)std::ceil(dispatch.cellCount / 64.0f), 1, 1);
+
+		if (staging->m_optimize)//Released once the optimized mesh is copied back, see RecordMeshTransfers
+			continue;
+		bufferMemB.buffer = vertBI.buffer;
+		bufferMemB.offset = vertBI.offset;
+		bufferMemB.size = vertBI.range;
+		bufferMemB.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		m_bufferBarriers.push_back(bufferMemB);
+		bufferMemB.buffer = idxsBI.buffer;
+		bufferMemB.offset = idxsBI.offset;
+		bufferMemB.size = idxsBI.range;
+		bufferMemB.dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
+		m_bufferBarriers.push_back(bufferMemB);
+	}
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		0,
+		0, nullptr,
+		static_cast<uint32_t>(m_bufferBarriers.size()), m_bufferBarriers.data(),
+		0, nullptr);
+
+	for (const AssemblyDispatch& dispatch : m_assembly)
+	{
+		if (!dispatch.indirect)//Speculative assemblies complete with their analysis
+			vkCmdSetEvent(commandBuffer, dispatch.staging->m_assemblyCompleteEvent, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "VoxelChunk.h"
+#include <vector>
+
+//Build commands of every chunk a traversal advanced this frame, recorded stage by stage into one command buffer.
+//Each pipeline is bound once per stage and chunks of a stage share a single barrier instead of one per chunk and form.
+class ChunkBuildBatch
+{
+public:
+	void AddLayoutTransition(const VkImageMemoryBarrier& colorBarrier, const VkImageMemoryBarrier& indexBarrier);
+	void AddForm(ChunkStagingResources* staging, uint32_t formIndex, ComputePipeline* formCompute, const FormConstants& constants);
+	void AddAnalysis(ChunkStagingResources* staging, const SurfaceAnalysisConstants& constants);
+	void AddAssembly(ChunkStagingResources* staging, const SurfaceAssemblyConstants& constants, uint32_t cellCount);
+	//Assembly of a chunk analysed in this batch, dispatched with the group count the analysis wrote
+	void AddIndirectAssembly(ChunkStagingResources* staging, const SurfaceAssemblyConstants& constants);
+	//Copies of an optimized mesh into ChunkStagingResources::m_meshStaging and back over its arena ranges
+	void AddMeshReadback(ChunkStagingResources* staging);
+	void AddMeshUpload(ChunkStagingResources* staging);
+
+	//Records everything added since the last call and empties the batch
+	void Record(Engine* instance, VkCommandBuffer commandBuffer);
+	inline bool Empty() const { return m_analysis.empty() && m_assembly.empty() && m_layoutBarriers.empty() && m_meshReadbacks.empty() && m_meshUploads.empty(); }
+
+private:
+	struct FormDispatch
+	{
+		ChunkStagingResources* staging = nullptr;
+		uint32_t formIndex = 0;
+		ComputePipeline* formCompute = nullptr;
+		FormConstants constants = {};
+	};
+
+	struct AnalysisDispatch
+	{
+		ChunkStagingResources* staging = nullptr;
+		SurfaceAnalysisConstants constants = {};
+	};
+
+	struct AssemblyDispatch
+	{
+		ChunkStagingResources* staging = nullptr;
+		SurfaceAssemblyConstants constants = {};
+		uint32_t cellCount = 0;
+		bool indirect = false;
+	};
+
+	void RecordVolumes(Engine* instance, VkCommandBuffer commandBuffer);
+	void RecordAssemblies(Engine* instance, VkCommandBuffer commandBuffer);
+	void RecordReadback(VkCommandBuffer commandBuffer);
+	void RecordMeshTransfers(Engine* instance, VkCommandBuffer commandBuffer);
+
+	std::vector<VkImageMemoryBarrier> m_layoutBarriers = {};
+	std::vector<FormDispatch> m_forms = {};
+	std::vector<AnalysisDispatch> m_analysis = {};
+	std::vector<AssemblyDispatch> m_assembly = {};
+	std::vector<ChunkStagingResources*> m_meshReadbacks = {};
+	std::vector<ChunkStagingResources*> m_meshUploads = {};
+	std::vector<VkBufferMemoryBarrier> m_bufferBarriers = {};
+};
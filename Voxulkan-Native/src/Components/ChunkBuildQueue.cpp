@@ -0,0 +1,49 @@
+#include "ChunkBuildQueue.h"
+#include <algorithm>
+
+void ChunkBuildQueue::Submit(std::vector<ChunkBuildRequest>& requests)
+{
+	if (requests.empty())
+		return;
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_requests.insert(m_requests.end(), requests.begin(), requests.end());
+}
+
+void ChunkBuildQueue::Cancel(VoxelBody* body)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_requests.erase(std::remove_if(m_requests.begin(), m_requests.end(),
+		[body](const ChunkBuildRequest& request) { return request.body == body; }), m_requests.end());
+}
+
+uint32_t ChunkBuildQueue::Grant(ChunkStagingPool* staging, uint32_t budget)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_backlog = static_cast<uint32_t>(m_requests.size());
+	m_granted = 0;
+	m_starved = 0;
+
+	size_t count = std::min(m_requests.size(), (size_t)budget);
+	std::partial_sort(m_requests.begin(), m_requests.begin() + count, m_requests.end());
+
+	ChunkStagingResources* resources;
+	for (size_t i = 0; i < count; i++)
+	{
+		VoxelChunk* chunk = m_requests[i].chunk;
+		if (chunk->m_staging)
+			continue;
+		if (!staging->TryAcquire(resources))
+		{
+			m_starved = static_cast<uint32_t>(count - i);
+			break;
+		}
+
+		resources->Reset();
+		chunk->m_staging = resources;
+		m_granted++;
+	}
+
+	m_requests.clear();
+	return m_granted;
+}
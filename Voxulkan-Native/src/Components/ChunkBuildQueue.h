@@ -0,0 +1,45 @@
+#pragma once
+#include "ChunkStagingPool.h"
+#include <mutex>
+#include <vector>
+
+class VoxelBody;
+
+//Leaf that needs staging resources before it can start building
+struct ChunkBuildRequest
+{
+	VoxelBody* body = nullptr;
+	VoxelChunk* chunk = nullptr;
+	float error = 0.0f;
+	float distance = 0.0f;
+
+	//Orders the most important request first, largest error then closest
+	bool operator<(const ChunkBuildRequest& rhs)const
+	{
+		return error > rhs.error || (error == rhs.error && distance < rhs.distance);
+	}
+};
+
+//Build requests of every body for the current frame.
+//Bodies submit while traversing, staging resources are handed out by priority once all of them are done
+//so far away chunks can no longer take the slots near ones are waiting for.
+class ChunkBuildQueue
+{
+public:
+	void Submit(std::vector<ChunkBuildRequest>& requests);
+	void Cancel(VoxelBody* body);
+
+	//Gives staging resources to at most budget requests and drops the rest, they are requested again next frame
+	uint32_t Grant(ChunkStagingPool* staging, uint32_t budget);
+
+	inline uint32_t Backlog() const { return m_backlog; }
+	inline uint32_t Granted() const { return m_granted; }
+	inline uint32_t Starved() const { return m_starved; }//Requests within budget the pool ran out for
+
+private:
+	std::mutex m_lock;
+	std::vector<ChunkBuildRequest> m_requests = {};
+	uint32_t m_backlog = 0;
+	uint32_t m_granted = 0;
+	uint32_t m_starved = 0;
+};
@@ -0,0 +1,222 @@
+#include "ChunkStagingPool.h"
+#include "..//Engine.h"
+#include "..//Plugin.h"
+#include <algorithm>
+
+ChunkStagingPool::ChunkStagingPool(uint32_t minCount, uint64_t byteBudget)
+{
+	m_minCount = std::min(minCount, (uint32_t)STAGING_MAX_COUNT);
+	m_stats.byteBudget = byteBudget;
+	m_available = new MPMCQueue<ChunkStagingResources*>(STAGING_MAX_COUNT);
+}
+
+ChunkStagingPool::~ChunkStagingPool()
+{
+	SAFE_DEL(m_available);
+}
+
+void ChunkStagingPool::Release(Engine* instance)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	//Pools are destroyed with their sets, resources only release their memory
+	std::vector<GPUResourceHandle*> resources;
+	ChunkStagingResources* handle;
+	while (m_available->try_pop(handle))
+	{
+		handle->m_descriptorPool = VK_NULL_HANDLE;
+		resources.push_back(handle);
+	}
+	instance->DestroyResources(resources);
+
+	if (resources.size() != m_stats.count)
+		LOG("ERROR: " + std::to_string(m_stats.count - resources.size()) + " staging resources were not returned");
+
+	std::lock_guard<std::mutex> guard(m_descriptorLock);
+	for (VkDescriptorPool pool : m_descriptorPools)
+		vkDestroyDescriptorPool(instance->Device(), pool, nullptr);
+	m_descriptorPools.clear();
+	m_availableCount = 0;
+	m_stats.count = 0;
+	m_stats.byteCount = 0;
+}
+
+bool ChunkStagingPool::TryAcquire(ChunkStagingResources*& resources)
+{
+	if (!m_available->try_pop(resources))
+		return false;
+	m_availableCount--;
+	return true;
+}
+
+void ChunkStagingPool::Return(ChunkStagingResources* resources)
+{
+	m_availableCount++;
+	m_available->push(resources);//Never full, the queue holds every resource there can be
+}
+
+void ChunkStagingPool::Update(Engine* instance, uint32_t backlog, uint32_t starved)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_stats.backlog = backlog;
+	m_stats.starved = starved;
+	uint32_t available = m_availableCount.load();
+
+	if (m_stats.count < m_minCount)
+	{
+		Grow(instance, m_minCount - m_stats.count);
+	}
+	else if (m_stats.byteCount > m_stats.byteBudget && m_stats.count > m_minCount && m_resourceBytes > 0)
+	{
+		//Budget was lowered, give back what is idle
+		uint64_t excess = (m_stats.byteCount - m_stats.byteBudget + m_resourceBytes - 1) / m_resourceBytes;
+		Retire(instance, (uint32_t)std::min((uint64_t)std::min(available, m_stats.count - m_minCount), excess));
+	}
+	else if (starved > 0)
+	{
+		Grow(instance, STAGING_BLOCK_SIZE);
+	}
+
+	//Retire idle resources that stayed unused for STAGING_RETIRE_FRAMES
+	if (starved == 0 && m_stats.count > m_minCount && available >= STAGING_BLOCK_SIZE)
+	{
+		m_minSurplus = m_surplusFrames == 0 ? available : std::min(m_minSurplus, available);
+		if (++m_surplusFrames >= STAGING_RETIRE_FRAMES)
+		{
+			uint32_t count = std::min(std::min(m_minSurplus, (uint32_t)STAGING_BLOCK_SIZE), m_stats.count - m_minCount);
+			Retire(instance, count);
+			m_surplusFrames = 0;
+		}
+	}
+	else
+	{
+		m_surplusFrames = 0;
+	}
+}
+
+uint32_t ChunkStagingPool::Grow(Engine* instance, uint32_t count)
+{
+	VkDescriptorSet sets[3];
+	VkDescriptorPool pool;
+	uint32_t created = 0;
+	for (; created < count && m_stats.count < STAGING_MAX_COUNT; created++)
+	{
+		if (m_resourceBytes > 0 && m_stats.count >= m_minCount && m_stats.byteCount + m_resourceBytes > m_stats.byteBudget)
+			break;
+		if (!AllocateDescriptorSets(instance, sets, pool))
+			break;
+
+		ChunkStagingResources* resources = new ChunkStagingResources(instance, Engine::CHUNK_SIZE, Engine::CHUNK_PADDING);
+		if (!resources->Allocated())//Out of device memory, builds wait for what is pooled until the governor frees some
+		{
+			LOG("Failed to allocate chunk staging resources");
+			FreeDescriptorSets(instance, pool, sets);
+			resources->Deallocate(instance);
+			SAFE_DEL(resources);
+			break;
+		}
+		resources->m_descriptorPool = pool;
+		resources->WriteDescriptors(instance, sets[0], sets[1], sets[2]);
+		m_resourceBytes = resources->m_byteCount;
+
+		m_stats.count++;
+		m_stats.allocations++;
+		m_stats.byteCount += resources->m_byteCount;
+		Return(resources);
+	}
+	return created;
+}
+
+uint32_t ChunkStagingPool::Retire(Engine* instance, uint32_t count)
+{
+	//Destroyed through the garbage collector since work recorded before the return may still be in flight
+	ChunkStagingResources* resources;
+	uint32_t retired = 0;
+	for (; retired < count && m_stats.count > 0 && TryAcquire(resources); retired++)
+	{
+		m_stats.count--;
+		m_stats.retirements++;
+		m_stats.byteCount -= std::min(m_stats.byteCount, resources->m_byteCount);
+		instance->DestroyResource(resources);
+	}
+	return retired;
+}
+
+VkDescriptorPool ChunkStagingPool::CreateDescriptorPool(Engine* instance)
+{
+	VkDescriptorPoolCreateInfo descPoolCI = {};
+	descPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descPoolCI.maxSets = STAGING_BLOCK_SIZE * 3;
+	descPoolCI.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+
+	std::vector<VkDescriptorPoolSize> DPSizes(2);
+	DPSizes[0].descriptorCount = STAGING_BLOCK_SIZE * 5;
+	DPSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	DPSizes[1].descriptorCount = STAGING_BLOCK_SIZE * 4;
+	DPSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+	descPoolCI.poolSizeCount = static_cast<uint32_t>(DPSizes.size());
+	descPoolCI.pPoolSizes = DPSizes.data();
+
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	if (vkCreateDescriptorPool(instance->Device(), &descPoolCI, nullptr, &pool) != VK_SUCCESS)
+	{
+		LOG("Failed to create staging descriptor pool");
+		return VK_NULL_HANDLE;
+	}
+	return pool;
+}
+
+bool ChunkStagingPool::AllocateDescriptorSets(Engine* instance, VkDescriptorSet* sets, VkDescriptorPool& pool)
+{
+	VkDescriptorSetLayout layouts[3] = {
+		instance->m_formDSetLayout,
+		instance->m_surfaceAnalysisPipeline.m_descriptorSetLayouts[0],
+		instance->m_surfaceAssemblyPipeline.m_descriptorSetLayouts[0] };
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorSetCount = 3;
+	allocInfo.pSetLayouts = layouts;
+
+	std::lock_guard<std::mutex> guard(m_descriptorLock);
+	//Newest pool first, retired sets leave room in older ones
+	for (size_t i = m_descriptorPools.size(); i-- > 0;)
+	{
+		allocInfo.descriptorPool = m_descriptorPools[i];
+		if (vkAllocateDescriptorSets(instance->Device(), &allocInfo, sets) == VK_SUCCESS)
+		{
+			pool = m_descriptorPools[i];
+			return true;
+		}
+	}
+
+	allocInfo.descriptorPool = CreateDescriptorPool(instance);
+	if (allocInfo.descriptorPool == VK_NULL_HANDLE)
+		return false;
+	m_descriptorPools.push_back(allocInfo.descriptorPool);
+	if (vkAllocateDescriptorSets(instance->Device(), &allocInfo, sets) != VK_SUCCESS)
+		return false;
+	pool = allocInfo.descriptorPool;
+	return true;
+}
+
+void ChunkStagingPool::FreeDescriptorSets(Engine* instance, VkDescriptorPool pool, VkDescriptorSet* sets)
+{
+	std::lock_guard<std::mutex> guard(m_descriptorLock);
+	vkFreeDescriptorSets(instance->Device(), pool, 3, sets);
+}
+
+void ChunkStagingPool::SetByteBudget(uint64_t byteBudget)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_stats.byteBudget = byteBudget;
+}
+
+StagingPoolStats ChunkStagingPool::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	StagingPoolStats stats = m_stats;
+	stats.available = m_availableCount.load();
+	return stats;
+}
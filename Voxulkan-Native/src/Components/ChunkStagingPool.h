@@ -0,0 +1,62 @@
+#pragma once
+#include "VoxelChunk.h"
+#include "..//Containers/MPMCQueue.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#define STAGING_BLOCK_SIZE 8 //Resources (and descriptor set triples) added or retired at a time
+#define STAGING_MAX_COUNT 1024
+#define STAGING_RETIRE_FRAMES 300 //Frames a surplus has to last before it is retired
+
+typedef struct StagingPoolStats
+{
+	uint32_t count = 0;//Resources alive, in use or idle
+	uint32_t available = 0;//Idle resources
+	uint32_t backlog = 0;//Build requests last frame
+	uint32_t starved = 0;//Requests within the build budget left without staging last frame
+	uint64_t allocations = 0;//Resources created since initialization
+	uint64_t retirements = 0;//Resources retired since initialization
+	uint64_t byteCount = 0;//Device memory held by the pool
+	uint64_t byteBudget = 0;
+} StagingPoolStats;
+
+//Staging resources for chunk builds.
+//Grows by blocks while builds are starved for staging and the VRAM budget allows, retires idle blocks once the backlog is gone.
+//Descriptor sets come from pools created STAGING_BLOCK_SIZE resources at a time.
+class ChunkStagingPool
+{
+public:
+	ChunkStagingPool(uint32_t minCount, uint64_t byteBudget);
+	~ChunkStagingPool();
+	void Release(Engine* instance);
+
+	bool TryAcquire(ChunkStagingResources*& resources);
+	void Return(ChunkStagingResources* resources);
+
+	//Called once a frame after ChunkBuildQueue handed out staging
+	void Update(Engine* instance, uint32_t backlog, uint32_t starved);
+	void FreeDescriptorSets(Engine* instance, VkDescriptorPool pool, VkDescriptorSet* sets);
+
+	void SetByteBudget(uint64_t byteBudget);
+	StagingPoolStats GetStats();
+
+private:
+	uint32_t Grow(Engine* instance, uint32_t count);
+	uint32_t Retire(Engine* instance, uint32_t count);
+	bool AllocateDescriptorSets(Engine* instance, VkDescriptorSet* sets, VkDescriptorPool& pool);
+	VkDescriptorPool CreateDescriptorPool(Engine* instance);
+
+	MPMCQueue<ChunkStagingResources*>* m_available = nullptr;
+	std::atomic<uint32_t> m_availableCount = { 0 };
+	uint32_t m_minCount = 0;
+	uint64_t m_resourceBytes = 0;
+	uint32_t m_surplusFrames = 0;
+	uint32_t m_minSurplus = 0;
+
+	std::mutex m_descriptorLock;
+	std::vector<VkDescriptorPool> m_descriptorPools = {};
+
+	std::mutex m_lock;
+	StagingPoolStats m_stats = {};
+};
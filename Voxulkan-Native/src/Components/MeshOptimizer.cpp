@@ -0,0 +1,135 @@
+#include "MeshOptimizer.h"
+#include <cstring>
+
+float ComputeACMR(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return 0.0f;
+
+	//Vertex v is cached while fewer than cacheSize misses happened since its own
+	std::vector<uint32_t> stamps(vertexCount, 0);
+	uint32_t misses = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t v = indices[i];
+		if (stamps[v] != 0 && misses - stamps[v] < cacheSize)
+			continue;
+		stamps[v] = ++misses;
+	}
+	return (float)misses / (float)triangleCount;
+}
+
+void MeshOptimizer::OptimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || vertexCount == 0)
+		return;
+
+	m_adjacencyOffsets.assign((size_t)vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		m_adjacencyOffsets[indices[i] + 1]++;
+	for (uint32_t v = 0; v < vertexCount; v++)
+		m_adjacencyOffsets[v + 1] += m_adjacencyOffsets[v];
+
+	m_liveCounts.resize(vertexCount);
+	m_cacheTimes.assign(m_adjacencyOffsets.begin(), m_adjacencyOffsets.end() - 1);//Fill cursors for now
+	m_adjacency.resize(triangleCount * 3);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (size_t k = 0; k < 3; k++)
+			m_adjacency[m_cacheTimes[indices[t * 3 + k]]++] = (uint32_t)t;
+	}
+	for (uint32_t v = 0; v < vertexCount; v++)
+		m_liveCounts[v] = m_adjacencyOffsets[v + 1] - m_adjacencyOffsets[v];
+
+	m_cacheTimes.assign(vertexCount, 0);
+	m_time = cacheSize + 1;
+	m_emitted.assign(triangleCount, 0);
+	m_deadEnds.clear();
+	m_output.clear();
+	m_output.reserve(triangleCount * 3);
+
+	uint32_t cursor = 0;
+	int64_t fan = 0;
+	while (fan >= 0)
+	{
+		m_candidates.clear();
+		for (uint32_t a = m_adjacencyOffsets[fan]; a < m_adjacencyOffsets[fan + 1]; a++)
+		{
+			uint32_t t = m_adjacency[a];
+			if (m_emitted[t])
+				continue;
+			m_emitted[t] = 1;
+
+			for (size_t k = 0; k < 3; k++)
+			{
+				uint32_t v = indices[t * 3 + k];
+				m_output.push_back(v);
+				m_deadEnds.push_back(v);
+				m_candidates.push_back(v);
+				m_liveCounts[v]--;
+				if (m_time - m_cacheTimes[v] > cacheSize)
+					m_cacheTimes[v] = m_time++;
+			}
+		}
+		fan = NextVertex(cacheSize, cursor, vertexCount);
+	}
+
+	std::memcpy(indices, m_output.data(), m_output.size() * sizeof(uint32_t));
+}
+
+//Fans next around the candidate staying longest in the cache once its remaining triangles are emitted,
+//falling back to the most recently used vertex with triangles left and then to the input order
+int64_t MeshOptimizer::NextVertex(uint32_t cacheSize, uint32_t& cursor, uint32_t vertexCount)
+{
+	int64_t best = -1;
+	int64_t bestPriority = -1;
+	for (uint32_t v : m_candidates)
+	{
+		if (m_liveCounts[v] == 0)
+			continue;
+		int64_t priority = 0;
+		if (m_time - m_cacheTimes[v] + 2 * m_liveCounts[v] <= cacheSize)
+			priority = m_time - m_cacheTimes[v];
+		if (priority > bestPriority)
+		{
+			best = v;
+			bestPriority = priority;
+		}
+	}
+	if (best >= 0)
+		return best;
+
+	while (!m_deadEnds.empty())
+	{
+		uint32_t v = m_deadEnds.back();
+		m_deadEnds.pop_back();
+		if (m_liveCounts[v] > 0)
+			return v;
+	}
+	for (; cursor < vertexCount; cursor++)
+	{
+		if (m_liveCounts[cursor] > 0)
+			return cursor;
+	}
+	return -1;
+}
+
+void MeshOptimizer::OptimizeVertexFetch(uint32_t* indices, size_t indexCount, uint32_t vertexCount, std::vector<uint32_t>& remap)
+{
+	remap.assign(vertexCount, UINT32_MAX);
+	uint32_t next = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t& slot = remap[indices[i]];
+		if (slot == UINT32_MAX)
+			slot = next++;
+		indices[i] = slot;
+	}
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		if (remap[v] == UINT32_MAX)
+			remap[v] = next++;
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define VERTEX_CACHE_SIZE 16U //FIFO post transform cache entries the triangle order is tuned for
+
+//Average cache miss ratio, transformed vertices per triangle with a FIFO cache of cacheSize entries.
+//0.5 is the best a regular grid can do, 3.0 means every vertex is transformed again.
+float ComputeACMR(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+//Reorders chunk meshes once they are assembled, see VoxelChunk::OptimizeMesh.
+//Triangles follow Tipsify (Sander, Nehab and Barczak 2007), which fans around recently used vertices and is linear in the index count.
+//Vertices are then renumbered in first use order so fetches walk the vertex buffer forward.
+//Scratch memory is kept between meshes, one optimizer per thread.
+class MeshOptimizer
+{
+public:
+	void OptimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+	//Rewrites indices and fills remap with the new position of every vertex, unreferenced vertices move to the end
+	void OptimizeVertexFetch(uint32_t* indices, size_t indexCount, uint32_t vertexCount, std::vector<uint32_t>& remap);
+
+private:
+	int64_t NextVertex(uint32_t cacheSize, uint32_t& cursor, uint32_t vertexCount);
+
+	std::vector<uint32_t> m_adjacencyOffsets = {};
+	std::vector<uint32_t> m_adjacency = {};//Triangles using each vertex
+	std::vector<uint32_t> m_liveCounts = {};//Triangles of each vertex not emitted yet
+	std::vector<uint32_t> m_cacheTimes = {};
+	std::vector<uint32_t> m_deadEnds = {};
+	std::vector<uint32_t> m_candidates = {};
+	std::vector<uint8_t> m_emitted = {};
+	std::vector<uint32_t> m_output = {};
+	uint32_t m_time = 0;
+};
@@ -1,24 +1,44 @@
 #include "VoxelBody.h"
 #include "..//Engine.h"
 #include "..//Plugin.h"
+#include "..//Containers/DistanceOrder.h"
 #include <glm/glm.hpp>
 #include <algorithm>
+#include <cfloat>
 
 VoxelBody::VoxelBody(const glm::vec3& min, const glm::vec3& max)
 {
-	m_root.m_min = min;
-	m_root.m_max = max;
+	m_root = m_nodes.AllocateBlock(1);
+	m_nodes.Min(m_root) = min;
+	m_nodes.Max(m_root) = max;
 	const_cast<glm::mat4x4&>(m_transform) = glm::mat4x4(1.0f);
 	m_trash = new std::vector<GPUResourceHandle*>[Engine::WORKER_CMDB_COUNT];
 }
 
+VoxelBody::~VoxelBody()
+{
+	SAFE_DEL_ARR(m_trash);
+}
+
 inline float ComputeError(float distance, float size)
 {
 	return size / std::max(distance, 0.00001f);
 }
 
-void VoxelBody::RenderChunk(const VoxelChunk& chunk, std::vector<ChunkRenderPackage>& render, glm::vec3& min, glm::vec3& max)
+//How far the observer can move before ComputeError of the node could cross E.
+//The distance to a box changes at most as much as the observer moves and the error crosses E at sqrt(size / E).
+inline float DecisionSlack(float distance, float size, float E)
+{
+	if (E <= 0.0f)
+		return FLT_MAX;
+	float d = std::sqrt(std::max(distance, 0.00001f));
+	float r = std::sqrt(size / E);
+	return std::abs(d - r) - (d + r) * 0.0001f;//Margin for rounding in UpdateDistance
+}
+
+void VoxelBody::RenderChunk(NodeIndex node, std::vector<ChunkRenderPackage>& render, glm::vec3& min, glm::vec3& max)
 {
+	const VoxelChunk& chunk = m_nodes.Chunk(node);
 	if (chunk.m_indexCount != 0 &&
 		chunk.m_vertexBuffer.m_gpuHandle != nullptr &&
 		chunk.m_indexBuffer.m_gpuHandle != nullptr)
@@ -27,25 +47,47 @@ void VoxelBody::RenderChunk(const VoxelChunk& chunk, std::vector<ChunkRenderPack
 		p.vertexBuffer = chunk.m_vertexBuffer.m_gpuHandle;
 		p.indexBuffer = chunk.m_indexBuffer.m_gpuHandle;
 		p.indexCount = chunk.m_indexCount;
-		p.max = chunk.m_max;
-		p.min = chunk.m_min;
+		p.indexType = IndexType(chunk.m_vertexCount);
+		p.max = m_nodes.Max(node);
+		p.min = m_nodes.Min(node);
 		max = glm::max(max, p.max);
 		min = glm::min(min, p.min);
 		render.push_back(p);
 	}
 }
 
-void VoxelBody::RenderDanglingBranches(Engine* instance, VoxelChunk& chunk, std::vector<ChunkRenderPackage>& render, glm::vec3& min, glm::vec3& max)
+void VoxelBody::RenderDanglingBranches(Engine* instance, NodeIndex node, std::vector<ChunkRenderPackage>& render, glm::vec3& min, glm::vec3& max)
 {
-	RenderChunk(chunk, render, min, max);
+	RenderChunk(node, render, min, max);
+	m_nodes.CacheEpoch(node) = 0;
 
-	for (size_t i = 0; i < chunk.m_subChunks.size(); i++)
+	NodeIndex first = m_nodes.FirstChild(node);
+	if (first == NULL_NODE)
+		return;
+	for (NodeIndex i = first; i < first + m_nodes.ChildCount(node); i++)
 	{
-		RenderDanglingBranches(instance,chunk.m_subChunks[i], render, min, max);
-		chunk.m_subChunks[i].ReleaseStaging(instance);
+		RenderDanglingBranches(instance, i, render, min, max);
+		m_nodes.Chunk(i).ReleaseStaging(instance);
 	}
 }
 
+VkCommandBuffer VoxelBody::BeginWorkerCommands(Engine* instance, WorkerResource* worker)
+{
+	QueueResource& queue = instance->m_queues[worker->m_queueIndex];
+	if (vkWaitForFences(instance->Device(), 1, &queue.m_fences[queue.m_currentCMDB], VK_TRUE, ~0ULL) != VK_SUCCESS)
+		return nullptr;
+
+	VkCommandBuffer cmdb = worker->m_computeCMDBs[queue.m_currentCMDB];
+	if (!worker->m_recordingCmds)
+	{
+		VkCommandBufferBeginInfo beginI = {};
+		beginI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginI.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CALL(vkBeginCommandBuffer(cmdb, &beginI));
+		worker->m_recordingCmds = true;
+	}
+	return cmdb;
+}
 
 void VoxelBody::Traverse(Engine* instance, const glm::vec3& observerPosition, float E, float voxelSize, BodyForm* forms, uint32_t formsCount, uint32_t maxDepth)
 {
@@ -57,109 +99,369 @@ void VoxelBody::Traverse(Engine* instance, const glm::vec3& observerPosition, fl
 	instance->DestroyResources(trash);
 	trash.clear();
 
-	std::vector<ChunkRenderPackage> render(0);
-	render.reserve(m_lastRenderSize);
-	glm::vec3 bodyMin = m_root.m_max;
-	glm::vec3 bodyMax = m_root.m_min;
+	TraverseContext context = {};
+	context.instance = instance;
+	context.commandBuffer = BeginWorkerCommands(instance, worker);
+	context.trash = &trash;
+	context.observerPosition = observerPosition;
+	context.E = E * instance->Governor().ErrorScale();
+	context.voxelSize = voxelSize;
+	context.forms = forms;
+	context.formsCount = formsCount;
+	context.maxDepth = maxDepth;
+	context.scheduler = instance->m_scheduler;
+	context.parallelDepth = m_parallelDepth;
+	context.incremental = m_incremental;
+	context.render.reserve(m_lastRenderSize);
+	TraverseTree(context);
+
+	instance->m_buildQueue.Submit(context.buildQueue);
+
+	m_lastRenderSize = context.render.size();
+	if (m_lastRenderSize > 0)
+	{
+		BodyRenderPackage& nbrp = instance->m_renderFrames.Back()[worker->m_index].Append();
+		nbrp.transform = const_cast<glm::mat4x4&>(m_transform);
+		nbrp.chunks.swap(context.render);
+		nbrp.bounds.Resize(nbrp.chunks.size());
+		for (size_t i = 0; i < nbrp.chunks.size(); i++)
+			nbrp.bounds.Set(i, nbrp.chunks[i].min, nbrp.chunks[i].max);
+		nbrp.min = context.bodyMin;
+		nbrp.max = context.bodyMax;
+	}
+
+	instance->m_workers->push(worker);
+}
+
+static void AccumulateStats(TraverseStats& stats, const TraverseStats& other)
+{
+	stats.visitedNodes += other.visitedNodes;
+	stats.leafNodes += other.leafNodes;
+	stats.buildRequests += other.buildRequests;
+	stats.queuedBuilds += other.queuedBuilds;
+	stats.unbuiltLeaves += other.unbuiltLeaves;
+	stats.skippedBuilds += other.skippedBuilds;
+	stats.reusedSubtrees += other.reusedSubtrees;
+}
+
+void VoxelBody::BeginIncrementalFrame(const TraverseContext& context)
+{
+	if (!context.incremental)
+	{
+		m_cacheValid = false;
+		m_lastRender.clear();
+		return;
+	}
+
+	if (!m_cacheValid ||
+		m_cacheE != context.E ||
+		m_cacheVoxelSize != context.voxelSize ||
+		m_cacheMaxDepth != context.maxDepth ||
+		m_cacheParallelDepth != context.parallelDepth)
+	{
+		//Nodes recorded under an older epoch are never settled
+		m_cacheEpoch++;
+		m_travel = 0.0;
+		m_cacheValid = true;
+		m_cacheE = context.E;
+		m_cacheVoxelSize = context.voxelSize;
+		m_cacheMaxDepth = context.maxDepth;
+		m_cacheParallelDepth = context.parallelDepth;
+	}
+	else
+	{
+		m_travel += glm::distance(context.observerPosition, m_lastObserver);
+	}
+	m_lastObserver = context.observerPosition;
+}
+
+void VoxelBody::TraverseTree(TraverseContext& context)
+{
+	TraverseOutput output = {};
+	output.commandBuffer = context.commandBuffer;
+	output.batch = &m_batch;
+	output.trash = context.trash;
+	output.render = &context.render;
+	output.buildQueue = &context.buildQueue;
+	output.min = m_nodes.Max(m_root);
+	output.max = m_nodes.Min(m_root);
+
+	BeginIncrementalFrame(context);
 
-	VkCommandBuffer cmdb = nullptr;
-	if (vkWaitForFences(instance->Device(), 1, &queue.m_fences[queue.m_currentCMDB], VK_TRUE, ~0ULL) == VK_SUCCESS)
+	m_taskCount = 0;
+	m_deferred.clear();
+	TraverseSubtree(context, m_root, 0, output, context.parallelDepth > 0);
+	if (context.incremental && context.parallelDepth == 0)
+		m_nodes.RenderBegin(m_root) = 0;
+
+	if (m_taskCount > 0)
 	{
-		cmdb = worker->m_computeCMDBs[queue.m_currentCMDB];
+		SubtreeTaskBatch batch = { this, &context };
+
+		if (context.scheduler)
+			context.scheduler->ParallelFor(m_taskCount, SubtreeTaskEntry, &batch);
+		else
+			for (uint32_t i = 0; i < m_taskCount; i++)
+				RunSubtreeTask(context, i);
 
-		if (!worker->m_recordingCmds)
+		for (uint32_t i = 0; i < m_taskCount; i++)
 		{
-			VkCommandBufferBeginInfo beginI = {};
-			beginI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginI.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-			VK_CALL(vkBeginCommandBuffer(cmdb, &beginI));
-			worker->m_recordingCmds = true;
+			SubtreeTask& task = m_tasks[i];
+			if (context.incremental)//Subtrees at the split depth are located in the final list
+				m_nodes.RenderBegin(task.node) = static_cast<uint32_t>(output.render->size());
+			output.render->insert(output.render->end(), task.render.begin(), task.render.end());
+			output.trash->insert(output.trash->end(), task.trash.begin(), task.trash.end());
+			output.buildQueue->insert(output.buildQueue->end(), task.buildQueue.begin(), task.buildQueue.end());
+			output.min = glm::min(output.min, task.output.min);
+			output.max = glm::max(output.max, task.output.max);
+			AccumulateStats(output.stats, task.output.stats);
+		}
+
+		//Deferred branches are in post order, tasks of a branch are the contiguous range below it
+		for (const DeferredBranch& branch : m_deferred)
+		{
+			uint32_t unbuilt = branch.unbuiltCount;
+			for (uint32_t i = branch.taskBegin; i < branch.taskEnd; i++)
+				unbuilt += m_tasks[i].unbuiltCount;
+
+			if (unbuilt == 0)//All children of branch are visible
+			{
+				m_nodes.Chunk(branch.node).ReleaseResources(context.instance, *output.trash);
+				m_nodes.SetBuilt(branch.node, false);
+			}
+			else
+			{
+				RenderChunk(branch.node, *output.render, output.min, output.max);
+			}
 		}
 	}
 
-	float leafSize = voxelSize * Engine::CHUNK_SIZE;
+	if (output.commandBuffer && !m_batch.Empty())
+		m_batch.Record(context.instance, output.commandBuffer);
+
+	if (context.incremental)
+		m_lastRender.assign(context.render.begin(), context.render.end());
+
+	context.bodyMin = output.min;
+	context.bodyMax = output.max;
+	context.stats = output.stats;
+	context.stats.tasks = m_taskCount;
+	context.stats.liveNodes = static_cast<uint32_t>(m_nodes.LiveCount());
+}
+
+void VoxelBody::SubtreeTaskEntry(void* data, uint32_t index)
+{
+	SubtreeTaskBatch* batch = static_cast<SubtreeTaskBatch*>(data);
+	batch->body->RunSubtreeTask(*batch->context, index);
+}
+
+void VoxelBody::RunSubtreeTask(const TraverseContext& context, uint32_t index)
+{
+	SubtreeTask& task = m_tasks[index];
+	task.render.clear();
+	task.trash.clear();
+	task.buildQueue.clear();
+	task.output = {};
+	task.output.render = &task.render;
+	task.output.trash = &task.trash;
+	task.output.buildQueue = &task.buildQueue;
+	task.output.batch = &task.batch;
+	task.output.min = m_nodes.Max(task.node);
+	task.output.max = m_nodes.Min(task.node);
+
+	//Each task records into a command buffer of its own, without one builds wait for the next frame
+	Engine* instance = context.instance;
+	WorkerResource* worker = nullptr;
+	bool settled = context.incremental && IsSettled(task.node);
+	if (!settled && instance && context.commandBuffer && instance->m_workers->try_pop(worker))
+		task.output.commandBuffer = BeginWorkerCommands(instance, worker);
+
+	task.unbuiltCount = TraverseSubtree(context, task.node, task.depth, task.output, false);
+	if (task.output.commandBuffer && !task.batch.Empty())
+		task.batch.Record(instance, task.output.commandBuffer);
+
+	if (worker)
+		instance->m_workers->push(worker);
+}
+
+struct TraversePosition
+{
+	size_t begin = 0;
+	size_t cursor = 0;
+	size_t end = 0;
+	uint32_t unbuiltCount = 0;
+	uint32_t taskBegin = 0;
+	bool returned = false;
+
+	//Incremental traversal state of the open branch
+	uint32_t renderBegin = 0;
+	uint32_t prevBegin = 0;
+	uint32_t unsettled = 0;
+	float slack = 0.0f;
+};
+
+//Reused between frames, every thread walks one subtree at a time
+static thread_local std::vector<NodeIndex> t_traverseOrder;
+static thread_local std::vector<TraversePosition> t_traverseStack;
+
+uint32_t VoxelBody::TraverseSubtree(const TraverseContext& context, NodeIndex root, int rootDepth, TraverseOutput& output, bool splitTasks)
+{
+	Engine* instance = context.instance;
+	VkCommandBuffer cmdb = output.commandBuffer;
+	std::vector<GPUResourceHandle*>& trash = *output.trash;
+	std::vector<ChunkRenderPackage>& render = *output.render;
+	TraverseStats& stats = output.stats;
+	glm::vec3& bodyMin = output.min;
+	glm::vec3& bodyMax = output.max;
+	const glm::vec3& observerPosition = context.observerPosition;
+	const float E = context.E;
+	const uint32_t maxDepth = context.maxDepth;
+	const int splitDepth = (int)context.parallelDepth;
+
+	float leafSize = context.voxelSize * Engine::CHUNK_SIZE;
 	uint32_t unbuiltCount = 0;
 
-	struct TraversePosition
+	//Counts everything that keeps a subtree from settling: build requests, unbuilt leaves and failed splits.
+	//Only subtrees at or below the split depth own a contiguous segment of the final render list,
+	//their begin is kept relative to the parent's so whole segments can be moved between frames.
+	uint32_t unsettled = 0;
+
+	//Children of each open branch are pushed onto the order buffer sorted by distance,
+	//stack entries point at their range so no chunk data is moved while sorting
+	std::vector<NodeIndex>& order = t_traverseOrder;
+	std::vector<TraversePosition>& stack = t_traverseStack;
+	if (stack.size() < maxDepth)
+		stack.resize(maxDepth);
+	order.clear();
+	order.push_back(root);
+
+	if (root == m_root)
+		m_nodes.UpdateDistance(root, observerPosition);
+	auto settle = [&](NodeIndex node, int level, uint32_t nodeBegin, float slack, bool stable)
 	{
-		VoxelChunk* chunk = nullptr;
-		size_t remainder = 0;
-		uint32_t unbuiltCount = 0;
-		bool returned = false;
+		m_nodes.CacheEpoch(node) = m_cacheEpoch;
+		m_nodes.SettledUntil(node) = stable ? m_travel + slack : -1.0;
+		m_nodes.RenderCount(node) = static_cast<uint32_t>(render.size()) - nodeBegin;
+		if (level > 0)
+		{
+			TraversePosition& parent = stack[level - 1];
+			m_nodes.RenderBegin(node) = nodeBegin - parent.renderBegin;
+			parent.slack = std::min(parent.slack, slack);
+		}
 	};
 
-	TraversePosition* stack = new TraversePosition[maxDepth];
-	m_root.UpdateDistance(observerPosition);
-	stack[0] = { &m_root, 0, 0, false};
-	int depth = 0;
+	stack[0] = { 0, 0, 1, 0, 0, false };
+	int depth = rootDepth;
 	do
 	{
-		TraversePosition& pos = stack[depth];
-		VoxelChunk& chunk = *(pos.chunk);
+		int level = depth - rootDepth;
+		TraversePosition& pos = stack[level];
+		NodeIndex node = order[pos.cursor];
+		bool cached = context.incremental && depth >= splitDepth;
+		uint32_t prevBegin = 0;
+		if (cached)//Location of the node's segment in the previous frame's render list
+			prevBegin = level == 0 ? m_nodes.RenderBegin(node) : stack[level - 1].prevBegin + m_nodes.RenderBegin(node);
+
 		if (pos.returned)//Branches would be the only thing to return
 		{
-			if (pos.unbuiltCount == unbuiltCount)//All children of branch are visible
+			if (splitTasks && pos.taskBegin != m_taskCount)//Decided once the tasks below it finished
 			{
-				chunk.ReleaseResources(instance, trash);
-				chunk.m_built = false;
+				DeferredBranch branch;
+				branch.node = node;
+				branch.unbuiltCount = unbuiltCount - pos.unbuiltCount;
+				branch.taskBegin = pos.taskBegin;
+				branch.taskEnd = m_taskCount;
+				m_deferred.push_back(branch);
+			}
+			else if (pos.unbuiltCount == unbuiltCount)//All children of branch are visible
+			{
+				m_nodes.Chunk(node).ReleaseResources(instance, trash);
+				m_nodes.SetBuilt(node, false);
 			}
 			else
 			{
-				RenderChunk(chunk, render, bodyMin, bodyMax);
+				RenderChunk(node, render, bodyMin, bodyMax);
 			}
 
+			if (cached)
+				settle(node, level, pos.renderBegin, pos.slack, pos.unsettled == unsettled);
 			pos.returned = false;
-			if (pos.remainder == 0)//Move up the higherarchy
+		}
+		else if (splitTasks && depth == splitDepth)//Hand the subtree to a task
+		{
+			if (m_tasks.size() <= m_taskCount)
+				m_tasks.resize((size_t)m_taskCount + 1);
+			m_tasks[m_taskCount].node = node;
+			m_tasks[m_taskCount].depth = depth;
+			m_taskCount++;
+		}
+		else if (cached && IsSettled(node) &&
+			(size_t)prevBegin + m_nodes.RenderCount(node) <= m_lastRender.size())//Nothing below can have changed
+		{
+			uint32_t nodeBegin = static_cast<uint32_t>(render.size());
+			auto segment = m_lastRender.begin() + prevBegin;
+			render.insert(render.end(), segment, segment + m_nodes.RenderCount(node));
+			for (size_t i = nodeBegin; i < render.size(); i++)
 			{
-				depth--;
+				bodyMin = glm::min(bodyMin, render[i].min);
+				bodyMax = glm::max(bodyMax, render[i].max);
 			}
-			else//Move to the next cell horizontally
+
+			if (level > 0)
 			{
-				pos.chunk++;
-				pos.remainder--;
+				TraversePosition& parent = stack[level - 1];
+				m_nodes.RenderBegin(node) = nodeBegin - parent.renderBegin;
+				parent.slack = std::min(parent.slack, (float)(m_nodes.SettledUntil(node) - m_travel));
 			}
+			stats.reusedSubtrees++;
 		}
 		else
 		{
-			glm::vec3 size = chunk.m_max - chunk.m_min;
+			stats.visitedNodes++;
+			uint32_t nodeUnsettled = unsettled;
+			glm::vec3 size = m_nodes.Max(node) - m_nodes.Min(node);
+			float area = size.x * size.y + size.x * size.z + size.z * size.y;
 
 			bool canBranch = depth < (int)maxDepth - 1 && (size.x > leafSize || size.y > leafSize || size.z > leafSize);
-			if (canBranch && ComputeError(chunk.m_distance, size.x * size.y + size.x * size.z + size.z * size.y) > E)//Branch
+			bool branch = canBranch && ComputeError(m_nodes.Distance(node), area) > E;
+			float slack = cached && canBranch ? DecisionSlack(m_nodes.Distance(node), area, E) : FLT_MAX;
+			NodeIndex first = m_nodes.FirstChild(node);
+			uint32_t subCount = m_nodes.ChildCount(node);
+			if (branch && first == NULL_NODE)
 			{
-				size_t subCount = chunk.m_subChunks.size();
-				if (subCount == 0)
+				float minAxis = std::max(std::min(size.x, std::min(size.y, size.z)), leafSize);
+				float desiredBranchSize = (1 << (maxDepth - (depth + 1))) * leafSize;
+				
+				if (desiredBranchSize < minAxis)
 				{
-					float minAxis = std::max(std::min(size.x, std::min(size.y, size.z)), leafSize);
-					float desiredBranchSize = (1 << (maxDepth - (depth + 1))) * leafSize;
-					
-					if (desiredBranchSize < minAxis)
-					{
-						float t = (float)(depth + 1.0f) / (float)maxDepth;
-						minAxis += std::lrint(t * (float)(desiredBranchSize - minAxis));
-					}
-#define AXISCOUNT(axis) axis <= leafSize ? 1U : std::max((uint32_t)std::ceilf(axis / minAxis), 2U)
-					glm::uvec3 subDiv(AXISCOUNT(size.x), AXISCOUNT(size.y), AXISCOUNT(size.z));
-					glm::vec3 subSize(size.x / (float)subDiv.x, size.y / (float)subDiv.y, size.z / (float)subDiv.z);
-					subCount = (size_t)subDiv.x * subDiv.y * subDiv.z;
-					chunk.m_subChunks.resize(subCount);
-					uint32_t i = 0;
+					float t = (float)(depth + 1.0f) / (float)maxDepth;
+					minAxis += std::lrint(t * (float)(desiredBranchSize - minAxis));
+				}
+#define AXISCOUNT(axis) axis <= leafSize ? 1U : std::max((uint32_t)std::ceil(axis / minAxis), 2U)
+				glm::uvec3 subDiv(AXISCOUNT(size.x), AXISCOUNT(size.y), AXISCOUNT(size.z));
+				glm::vec3 subSize(size.x / (float)subDiv.x, size.y / (float)subDiv.y, size.z / (float)subDiv.z);
+				subCount = subDiv.x * subDiv.y * subDiv.z;
+				first = m_nodes.AllocateBlock(subCount);
+				if (first != NULL_NODE)
+				{
+					m_nodes.FirstChild(node) = first;
+					m_nodes.ChildCount(node) = subCount;
+					m_nodes.ChildOrder(node) = NODE_ORDER_IDENTITY;
+
+					glm::vec3 nodeMin = m_nodes.Min(node);
+					NodeIndex i = first;
 					for (uint32_t x = 0; x < subDiv.x; x++)
 					{
 						for (uint32_t y = 0; y < subDiv.y; y++)
 						{
 							for (uint32_t z = 0; z < subDiv.z; z++)
 							{
-								VoxelChunk& subChunk = chunk.m_subChunks[i];
-								subChunk.m_min = {
-									chunk.m_min.x + subSize.x * x,
-									chunk.m_min.y + subSize.y * y,
-									chunk.m_min.z + subSize.z * z };
-								subChunk.m_max = { 
-									subChunk.m_min.x + subSize.x,
-									subChunk.m_min.y + subSize.y,
-									subChunk.m_min.z + subSize.z };
-
-								subChunk.UpdateDistance(observerPosition);
+								glm::vec3 subMin = {
+									nodeMin.x + subSize.x * x,
+									nodeMin.y + subSize.y * y,
+									nodeMin.z + subSize.z * z };
+								m_nodes.Min(i) = subMin;
+								m_nodes.Max(i) = subMin + subSize;
 								i++;
 							}
 						}
@@ -167,74 +469,138 @@ void VoxelBody::Traverse(Engine* instance, const glm::vec3& observerPosition, fl
 				}
 				else
 				{
-					for (int i = 0; i < subCount; i++)
-					{
-						chunk.m_subChunks[i].UpdateDistance(observerPosition);
-					}
+					branch = false;
+					unsettled++;
+				}
+			}
+
+			if (branch)
+			{
+				//A branch no longer builds, let a leaf have its staging
+				if (!m_nodes.IsBuilt(node))
+					m_nodes.Chunk(node).ReleaseStaging(instance);
+
+				for (NodeIndex i = first; i < first + subCount; i++)
+				{
+					m_nodes.UpdateDistance(i, observerPosition);
 				}
 
-				VoxelChunk* subChunks = chunk.m_subChunks.data();
-				std::sort(subChunks, subChunks + subCount);
+				size_t begin = order.size();
+				//Blocks never straddle pages, so the children's distances are contiguous
+				const float* distance = &m_nodes.Distance(first);
+				auto closer = [distance, first](NodeIndex a, NodeIndex b) { return distance[a - first] < distance[b - first]; };
+				if (subCount <= NODE_ORDER_MAX_CHILDREN)
+				{
+					//Seeded with last frame's order, which rarely changes while the observer moves smoothly
+					uint32_t childOrder = m_nodes.ChildOrder(node);
+					for (uint32_t k = 0; k < subCount; k++)
+						order.push_back(first + ((childOrder >> (k * 4)) & 0xF));
+					InsertionSort(order.data() + begin, subCount, closer);
+					childOrder = 0;
+					for (uint32_t k = 0; k < subCount; k++)
+						childOrder |= (order[begin + k] - first) << (k * 4);
+					m_nodes.ChildOrder(node) = childOrder;
+				}
+				else
+				{
+					for (NodeIndex i = first; i < first + subCount; i++)
+						order.push_back(i);
+					std::sort(order.begin() + begin, order.end(), closer);
+				}
 
 				pos.returned = true;
 				pos.unbuiltCount = unbuiltCount;
+				pos.taskBegin = m_taskCount;
+				pos.renderBegin = static_cast<uint32_t>(render.size());
+				pos.prevBegin = prevBegin;
+				pos.unsettled = nodeUnsettled;
+				pos.slack = slack;
 				depth++;
-				stack[depth] = { subChunks, subCount - 1, 0, false };
+				stack[depth - rootDepth] = { begin, begin, order.size(), 0, 0, false };
+				continue;
 			}
 			else//Leaf
 			{
-				if (!chunk.m_built && cmdb)
+				stats.leafNodes++;
+				uint32_t nodeBegin = static_cast<uint32_t>(render.size());
+				VoxelChunk& chunk = m_nodes.Chunk(node);
+				if (!m_nodes.IsBuilt(node) && context.buildOverride)
 				{
-					chunk.Build(instance, cmdb, voxelSize, forms, formsCount, trash);
+					unsettled++;
+					stats.buildRequests++;
+					m_nodes.SetBuilt(node, context.buildOverride(chunk, context.buildUserData));
 				}
-
-				if (chunk.m_built)
+				else if (!m_nodes.IsBuilt(node) && !chunk.m_staging &&
+					VoxelChunk::SurfaceFree(m_nodes.Min(node), m_nodes.Max(node), context.voxelSize, context.forms, context.formsCount))
 				{
-					RenderChunk(chunk, render, bodyMin, bodyMax);
-					chunk.ReleaseSubResources(instance, trash);
+					chunk.ReleaseResources(instance, trash);
+					m_nodes.SetBuilt(node, true);
+					stats.skippedBuilds++;
 				}
-				else
+				else if (!m_nodes.IsBuilt(node) && chunk.m_staging)
 				{
-					unbuiltCount++;
-					RenderDanglingBranches(instance, chunk, render, bodyMin, bodyMax);
+					if (cmdb)
+					{
+						unsettled++;
+						stats.buildRequests++;
+						m_nodes.SetBuilt(node, chunk.Build(instance, *output.batch, m_nodes.Min(node), m_nodes.Max(node),
+							context.voxelSize, context.forms, context.formsCount, trash));
+					}
+				}
+				else if (!m_nodes.IsBuilt(node) && output.buildQueue)//Waits for ChunkBuildQueue to grant staging
+				{
+					ChunkBuildRequest request;
+					request.body = this;
+					request.chunk = &chunk;
+					request.error = ComputeError(m_nodes.Distance(node), area);
+					request.distance = m_nodes.Distance(node);
+					output.buildQueue->push_back(request);
+					stats.queuedBuilds++;
 				}
 
-				if (pos.remainder == 0)//Move up the higherarchy
+				if (m_nodes.IsBuilt(node))
 				{
-					depth--;
+					RenderChunk(node, render, bodyMin, bodyMax);
+					m_nodes.ReleaseChildren(instance, node, trash);
 				}
-				else//Move to the next cell horizontally
+				else
 				{
-					pos.chunk++;
-					pos.remainder--;
+					unbuiltCount++;
+					unsettled++;
+					stats.unbuiltLeaves++;
+					RenderDanglingBranches(instance, node, render, bodyMin, bodyMax);
 				}
+
+				if (cached)
+					settle(node, level, nodeBegin, slack, unsettled == nodeUnsettled);
 			}
 		}
-	} while (depth >= 0);
 
-	delete[] stack;
-	m_lastRenderSize = render.size();
-	if (m_lastRenderSize > 0)
-	{
-		BodyRenderPackage& nbrp = instance->m_render.emplace_back();
-		nbrp.transform = const_cast<glm::mat4x4&>(m_transform);
-		nbrp.chunks.swap(render);
-		nbrp.min = bodyMin;
-		nbrp.max = bodyMax;
-	}
+		TraversePosition& current = stack[level];
+		if (current.cursor + 1 == current.end)//Move up the higherarchy
+		{
+			order.resize(current.begin);
+			depth--;
+		}
+		else//Move to the next cell horizontally
+		{
+			current.cursor++;
+		}
+	} while (depth >= rootDepth);
 
-	instance->m_workers->push(worker);
+	return unbuiltCount;
 }
 
 void VoxelBody::Deallocate(Engine* instance)
 {
-	m_root.ReleaseResources(instance, m_trash[0]);
-	m_root.ReleaseSubResources(instance, m_trash[0]);
+	instance->m_buildQueue.Cancel(this);
+	m_nodes.Chunk(m_root).ReleaseResources(instance, m_trash[0]);
+	m_nodes.ReleaseChildren(instance, m_root, m_trash[0]);
 
 	for (int i = 0; i < Engine::WORKER_CMDB_COUNT; i++)
 		instance->DestroyResources(m_trash[i]);
 
-	delete[] m_trash;
+	SAFE_DEL_ARR(m_trash);
 }
 
 EXPORT VoxelBody* CreateVoxelBody(glm::vec3 min, glm::vec3 max)
@@ -247,6 +613,16 @@ EXPORT void SetVoxelBodyTransform(VoxelBody* voxelBody, glm::mat4x4 transform)
 	const_cast<glm::mat4x4&>(voxelBody->m_transform) = transform;
 }
 
+EXPORT void SetVoxelBodyParallelDepth(VoxelBody* voxelBody, uint32_t parallelDepth)
+{
+	voxelBody->m_parallelDepth = parallelDepth;
+}
+
+EXPORT void SetVoxelBodyIncremental(VoxelBody* voxelBody, bool incremental)
+{
+	voxelBody->m_incremental = incremental;
+}
+
 EXPORT void DestroyVoxelBody(Engine* instance, VoxelBody* voxelBody)
 {
 	if (voxelBody)
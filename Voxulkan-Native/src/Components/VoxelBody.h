@@ -1,34 +1,166 @@
 #pragma once
-#include "VoxelChunk.h"
+#include "VoxelNodePool.h"
+#include "ChunkBuildQueue.h"
+#include "ChunkBuildBatch.h"
+#include "ChunkBounds.h"
+#include "..//TaskScheduler.h"
 #include "glm/vec3.hpp"
 
+struct WorkerResource;
+class VoxelBody;
+
 struct BodyRenderPackage
 {
 	std::vector<ChunkRenderPackage> chunks = {};
+	ChunkBounds bounds = {};//Boxes of chunks for batched culling
 	glm::mat4x4 transform = {};
 	glm::vec3 min = {};
 	glm::vec3 max = {};
+};
+
+//Bodies traversed by one worker during a frame, only that worker appends so no lock is taken.
+//Packages past count are left over from older frames and are reused in place.
+struct BodyRenderList
+{
+	std::vector<BodyRenderPackage> bodies = {};
+	size_t count = 0;
 
-	float distance = 0.0f;
-	bool operator<(const BodyRenderPackage& rhs)const
+	inline BodyRenderPackage& Append()
 	{
-		return distance < rhs.distance;
+		if (count == bodies.size())
+			bodies.emplace_back();
+		return bodies[count++];
 	}
 };
 
+//Replaces VoxelChunk::Build during traversal, returns whether the chunk is now built
+typedef bool(*ChunkBuildOverride)(VoxelChunk& chunk, void* userData);
+
+struct TraverseStats
+{
+	uint32_t visitedNodes = 0;
+	uint32_t leafNodes = 0;
+	uint32_t buildRequests = 0;
+	uint32_t queuedBuilds = 0;
+	uint32_t unbuiltLeaves = 0;
+	uint32_t skippedBuilds = 0;//Leaves found surface free by the form shells, built without staging
+	uint32_t liveNodes = 0;
+	uint32_t tasks = 0;
+	uint32_t reusedSubtrees = 0;
+};
+
+struct TraverseContext
+{
+	Engine* instance = nullptr;
+	VkCommandBuffer commandBuffer = nullptr;
+	std::vector<GPUResourceHandle*>* trash = nullptr;
+	glm::vec3 observerPosition = {};
+	float E = 0.0f;
+	float voxelSize = 1.0f;
+	BodyForm* forms = nullptr;
+	uint32_t formsCount = 0;
+	uint32_t maxDepth = 10;
+
+	//Subtrees rooted at parallelDepth run as scheduler tasks, 0 keeps the whole walk on the calling thread
+	TaskScheduler* scheduler = nullptr;
+	uint32_t parallelDepth = 0;
+
+	//Reuse the output of subtrees whose LOD decisions cannot have changed since the observer last moved
+	bool incremental = false;
+
+	//Used by benchmarks to run traversal without a device
+	ChunkBuildOverride buildOverride = nullptr;
+	void* buildUserData = nullptr;
+
+	std::vector<ChunkRenderPackage> render = {};
+	std::vector<ChunkBuildRequest> buildQueue = {};
+	glm::vec3 bodyMin = {};
+	glm::vec3 bodyMax = {};
+	TraverseStats stats = {};
+};
+
+//What the scheduler hands each subtree task of a traversal, see VoxelBody::SubtreeTaskEntry
+struct SubtreeTaskBatch
+{
+	VoxelBody* body = nullptr;
+	const TraverseContext* context = nullptr;
+};
+
 class VoxelBody
 {
 public:
 	VoxelBody(const glm::vec3& min, const glm::vec3& max);
+	~VoxelBody();
 	
 	void Traverse(Engine* instance, const glm::vec3& observerPosition, float E, float voxelSize, BodyForm* forms, uint32_t formsCount, uint32_t maxDepth = 10);
+	void TraverseTree(TraverseContext& context);
 	void Deallocate(Engine* instance);
 
 	volatile glm::mat4x4 m_transform = {};
+	uint32_t m_parallelDepth = 2;
+	bool m_incremental = false;
 private:
-	void RenderChunk(const VoxelChunk& chunk, std::vector<ChunkRenderPackage>& render, glm::vec3& min, glm::vec3& max);
-	void RenderDanglingBranches(Engine* instance, VoxelChunk& chunk, std::vector<ChunkRenderPackage>& render, glm::vec3& min, glm::vec3& max);
-	VoxelChunk m_root = {};
+	struct TraverseOutput
+	{
+		VkCommandBuffer commandBuffer = nullptr;
+		ChunkBuildBatch* batch = nullptr;//Recorded into commandBuffer once the subtree is done
+		std::vector<GPUResourceHandle*>* trash = nullptr;
+		std::vector<ChunkRenderPackage>* render = nullptr;
+		std::vector<ChunkBuildRequest>* buildQueue = nullptr;
+		glm::vec3 min = {};
+		glm::vec3 max = {};
+		TraverseStats stats = {};
+	};
+
+	//Subtree split off the top of the tree, owns everything it produces until the merge
+	struct SubtreeTask
+	{
+		NodeIndex node = NULL_NODE;
+		int depth = 0;
+		uint32_t unbuiltCount = 0;
+		std::vector<ChunkRenderPackage> render = {};
+		std::vector<GPUResourceHandle*> trash = {};
+		std::vector<ChunkBuildRequest> buildQueue = {};
+		ChunkBuildBatch batch;
+		TraverseOutput output = {};
+	};
+
+	//Branch above the split depth whose merge decision waits on its tasks
+	struct DeferredBranch
+	{
+		NodeIndex node = NULL_NODE;
+		uint32_t unbuiltCount = 0;
+		uint32_t taskBegin = 0;
+		uint32_t taskEnd = 0;
+	};
+
+	uint32_t TraverseSubtree(const TraverseContext& context, NodeIndex root, int rootDepth, TraverseOutput& output, bool splitTasks);
+	void RunSubtreeTask(const TraverseContext& context, uint32_t index);
+	static void SubtreeTaskEntry(void* data, uint32_t index);
+	static VkCommandBuffer BeginWorkerCommands(Engine* instance, WorkerResource* worker);
+	void BeginIncrementalFrame(const TraverseContext& context);
+	inline bool IsSettled(NodeIndex node) { return m_nodes.CacheEpoch(node) == m_cacheEpoch && m_travel < m_nodes.SettledUntil(node); }
+
+	void RenderChunk(NodeIndex node, std::vector<ChunkRenderPackage>& render, glm::vec3& min, glm::vec3& max);
+	void RenderDanglingBranches(Engine* instance, NodeIndex node, std::vector<ChunkRenderPackage>& render, glm::vec3& min, glm::vec3& max);
+	VoxelNodePool m_nodes;
+	NodeIndex m_root = NULL_NODE;
+	std::vector<SubtreeTask> m_tasks = {};
+	uint32_t m_taskCount = 0;
+	std::vector<DeferredBranch> m_deferred = {};
+	ChunkBuildBatch m_batch;
 	size_t m_lastRenderSize = 0;
+
+	//Incremental traversal, settled subtrees copy their segment of the previous frame's render list.
+	//m_travel is the distance the observer covered since the cache was last invalidated.
+	std::vector<ChunkRenderPackage> m_lastRender = {};
+	glm::vec3 m_lastObserver = {};
+	double m_travel = 0.0;
+	uint32_t m_cacheEpoch = 0;
+	bool m_cacheValid = false;
+	float m_cacheE = 0.0f;
+	float m_cacheVoxelSize = 0.0f;
+	uint32_t m_cacheMaxDepth = 0;
+	uint32_t m_cacheParallelDepth = 0;
 	std::vector<GPUResourceHandle*>* m_trash;
 };
\ No newline at end of file
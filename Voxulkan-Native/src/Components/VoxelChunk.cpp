@@ -1,20 +1,13 @@
 #include "VoxelChunk.h"
+#include "ChunkBuildBatch.h"
+#include "MeshOptimizer.h"
 #include "..//Engine.h"
 #include "..//Plugin.h"
 #include <algorithm>
 #include <stdlib.h>
+#include <cstring>
 #include <glm/gtx/transform.hpp>
 
-VoxelChunk::VoxelChunk()
-{
-	m_densityImage.m_format = VK_FORMAT_R8_UNORM;
-	m_densityImage.m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
-	m_densityImage.m_type = VK_IMAGE_TYPE_3D;
-	m_densityImage.m_viewType = VK_IMAGE_VIEW_TYPE_3D;
-	m_densityImage.m_usage = VK_IMAGE_USAGE_STORAGE_BIT;
-	m_densityImage.m_tiling = VK_IMAGE_TILING_OPTIMAL;
-}
-
 void VoxelChunk::SetMeshData(const GPUBuffer& vertexBuffer, const GPUBuffer& indexBuffer, uint32_t vertexCount, uint32_t indexCount)
 {
 	m_vertexBuffer = vertexBuffer;
@@ -25,18 +18,27 @@ void VoxelChunk::SetMeshData(const GPUBuffer& vertexBuffer, const GPUBuffer& ind
 
 #define SAFE_TRASH(res) if(res.m_gpuHandle) trash.push_back(res.m_gpuHandle); res.m_gpuHandle=nullptr;
 
+static SurfaceAssemblyConstants AssemblyConstants(const ChunkStagingResources* staging, const glm::vec3& min, const glm::vec3& max)
+{
+	SurfaceAssemblyConstants surfConsts = {};
+	surfConsts.base = glm::uvec3(Engine::CHUNK_PADDING, Engine::CHUNK_PADDING, Engine::CHUNK_PADDING);
+	surfConsts.offset = min;
+	surfConsts.scale = (max - min) / glm::vec3(staging->m_volumeSize);
+	surfConsts.vertexCapacity = (uint32_t)(std::max(staging->m_verticies.m_byteCount / VERTEX_BYTE_SIZE, VERTEX_HEADER_COUNT) - VERTEX_HEADER_COUNT);
+	surfConsts.indexCapacity = (uint32_t)(staging->m_indicies.m_byteCount / IndexByteSize(surfConsts.vertexCapacity));
+	return surfConsts;
+}
+
 void VoxelChunk::ReleaseResources(Engine* instance, std::vector<GPUResourceHandle*>& trash)
 {
 	/*
-	m_densityImage.Release(instance);
 	m_indexBuffer.Release(instance);
 	m_vertexBuffer.Release(instance);*/
 	size_t space = trash.capacity() - trash.size();
-	if (space < 3)
-		trash.reserve(3 - space);
+	if (space < 2)
+		trash.reserve(2 - space);
 
 
-	SAFE_TRASH(m_densityImage);
 	SAFE_TRASH(m_indexBuffer);
 	SAFE_TRASH(m_vertexBuffer);
 
@@ -49,80 +51,87 @@ void VoxelChunk::ReleaseStaging(Engine* instance)
 {
 	if (m_staging)
 	{
-		if (instance->m_stagingResources->try_push(m_staging))
-		{
-			m_staging = nullptr;
-		}
-		else
-		{
-			LOG("ERROR: Chunk failed to return staging resources");
-		}
+		instance->m_stagingPool->Return(m_staging);
+		m_staging = nullptr;
 	}
 }
 
-void VoxelChunk::ReleaseSubResources(Engine* instance, std::vector<GPUResourceHandle*>& trash)
+glm::uvec3 VoxelChunk::VolumeSize(const glm::vec3& min, const glm::vec3& max, float voxelSize, glm::vec3& pMin, glm::vec3& pMax)
 {
-	for (size_t i = 0; i < m_subChunks.size(); i++)
-	{
-		m_subChunks[i].ReleaseResources(instance, trash);
-		m_subChunks[i].ReleaseSubResources(instance, trash);
-	}
+	glm::vec3 size = max - min;
+	float sMax = std::max(size.x, std::max(size.y, size.z));
+	int rMax = std::min((int)std::round(sMax / voxelSize), (int)Engine::CHUNK_SIZE);
+#define RSIZE(axis) (uint32_t)std::round(rMax * axis / sMax)
+	glm::uvec3 effectiveSize(RSIZE(size.x), RSIZE(size.y), RSIZE(size.z));
 
-	m_subChunks.clear();
+	glm::vec3 vSize = size / glm::vec3(effectiveSize);
+	pMin = min - vSize * (float)Engine::CHUNK_PADDING;
+	pMax = max + vSize * ((float)Engine::CHUNK_PADDING + 1.0f);
+	return effectiveSize;
 }
 
-void VoxelChunk::AllocateVolume(Engine* instance, const glm::uvec3& size)
+//Which side of its shell the box lies on, 0 if it may hold the surface
+static int ShellSide(const BodyForm& form, const glm::vec3& pMin, const glm::vec3& pMax, float margin)
 {
-	m_densityImage.m_size = { size.x, size.y , size.z };
-	m_densityImage.Allocate(instance);
+	if (form.shellOuter <= form.shellInner)
+		return 0;
+	glm::vec3 nearest = glm::clamp(form.shellCenter, pMin, pMax) - form.shellCenter;
+	glm::vec3 farthest = glm::max(glm::abs(pMin - form.shellCenter), glm::abs(pMax - form.shellCenter));
+	if (glm::length(nearest) > form.shellOuter + margin)
+		return 1;
+	if (glm::length(farthest) < form.shellInner - margin)
+		return -1;
+	return 0;
 }
 
-void VoxelChunk::Build(Engine* instance, VkCommandBuffer commandBuffer, float voxelSize, BodyForm* forms, uint32_t formsCount, std::vector<GPUResourceHandle*>& trash)
+bool VoxelChunk::SurfaceFree(const glm::vec3& min, const glm::vec3& max, float voxelSize, const BodyForm* forms, uint32_t formsCount)
 {
-	if (!m_staging)
-	{
-		if (!instance->m_stagingResources->try_pop(m_staging))
-		{
-			m_staging = nullptr;
-			return;
-		}
+	if (formsCount == 0)
+		return false;
 
-		m_staging->Reset();
+	glm::vec3 pMin, pMax;
+	glm::uvec3 effectiveSize = VolumeSize(min, max, voxelSize, pMin, pMax);
+	if (effectiveSize.x == 0 || effectiveSize.y == 0 || effectiveSize.z == 0)
+		return false;
+	glm::vec3 vSize = (max - min) / glm::vec3(effectiveSize);
+	float margin = glm::length(vSize);//Covers quantization of densities next to the shell
+
+	//Form 0 writes the whole volume, later forms overwrite their own bounds.
+	//Without a surface every form reaching the volume has to be on the same side of its shell.
+	int side = ShellSide(forms[0], pMin, pMax, margin);
+	if (side == 0)
+		return false;
+	for (uint32_t i = 1; i < formsCount; i++)
+	{
+		const BodyForm& form = forms[i];
+		glm::vec3 fMin = glm::max(pMin, form.min - vSize);
+		glm::vec3 fMax = glm::min(pMax, form.max + vSize);
+		if (fMin.x > fMax.x || fMin.y > fMax.y || fMin.z > fMax.z)
+			continue;
+		if (ShellSide(form, fMin, fMax, margin) != side)
+			return false;
 	}
+	return true;
+}
 
-	if (!m_staging->Ready(instance, commandBuffer))
-		return;
+bool VoxelChunk::Build(Engine* instance, ChunkBuildBatch& batch, const glm::vec3& min, const glm::vec3& max, float voxelSize, BodyForm* forms, uint32_t formsCount, std::vector<GPUResourceHandle*>& trash)
+{
+	if (!m_staging)
+		return false;
+
+	if (!m_staging->Ready(instance, batch))
+		return false;
 
 	VkDevice device = instance->Device();
 	if (m_staging->m_stage == CHUNK_STAGE_IDLE)
 	{
 		m_staging->m_stage = CHUNK_STAGE_VOLUME_ANALYSIS;
+		m_staging->m_optimize = instance->m_meshOptimization;
 
-		glm::vec3 size = m_max - m_min;
-		float sMax = std::max(size.x, std::max(size.y, size.z));
-		int rMax = std::min((int)std::round(sMax / voxelSize), (int)Engine::CHUNK_SIZE);
-#define RSIZE(axis) (uint32_t)std::round(rMax * axis / sMax)
-		glm::uvec3 effectiveSize(RSIZE(size.x), RSIZE(size.y), RSIZE(size.z));
-		memcpy(&m_staging->m_density.m_size, &effectiveSize, sizeof(glm::uvec3));
-
-		VkImageMemoryBarrier colorMemB = {};
-		colorMemB.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		colorMemB.image = m_staging->m_colorMap.m_gpuHandle->m_image;
-		colorMemB.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		colorMemB.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		colorMemB.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		colorMemB.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		colorMemB.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-		colorMemB.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-		colorMemB.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		colorMemB.subresourceRange.baseArrayLayer = 0;
-		colorMemB.subresourceRange.baseMipLevel = 0;
-		colorMemB.subresourceRange.layerCount = 1;
-		colorMemB.subresourceRange.levelCount = 1;
-
-		glm::vec3 vSize = size / glm::vec3(effectiveSize);
-		glm::vec3 pMin = m_min - vSize * (float)Engine::CHUNK_PADDING;
-		glm::vec3 pMax = m_max + vSize * ((float)Engine::CHUNK_PADDING + 1.0f);
+		glm::vec3 pMin, pMax;
+		glm::uvec3 effectiveSize = VolumeSize(min, max, voxelSize, pMin, pMax);
+		m_staging->m_volumeSize = effectiveSize;
+		glm::vec3 vSize = (max - min) / glm::vec3(effectiveSize);
 
 		for (uint32_t i = 0; i < formsCount; i++)
 		{
@@ -154,94 +163,22 @@ void VoxelChunk::Build(Engine* instance, VkCommandBuffer commandBuffer, float vo
 				fConsts.transform = glm::translate(corner) * glm::scale(vSize);
 			}
 
-			VkPipeline formPipeline;
-			VkPipelineLayout formLayout;
-			form.formCompute->GetVkPipeline(formPipeline, formLayout);
-			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, formPipeline);
-			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, formLayout, 0, 1, &m_staging->m_formDSet, 0, nullptr);
-			vkCmdPushConstants(commandBuffer, formLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FormConstants), &fConsts);
-			vkCmdDispatch(commandBuffer,
-				(uint32_t)std::ceilf(fConsts.range.x / 4.0f),
-				(uint32_t)std::ceilf(fConsts.range.y / 4.0f),
-				(uint32_t)std::ceilf(fConsts.range.z / 4.0f));
-
-			if (i < formsCount - 1)
-			{
-				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-					0,
-					0, nullptr,
-					0, nullptr,
-					1, &colorMemB);
-			}
+			batch.AddForm(m_staging, i, form.formCompute, fConsts);
 		}
 
-		vkCmdFillBuffer(commandBuffer, m_staging->m_info.m_gpuHandle->m_buffer, 0, 24, 0);
-		vkCmdFillBuffer(commandBuffer, m_staging->m_info.m_gpuHandle->m_buffer, 24, 12, Engine::CHUNK_SIZE);
-
-		std::vector<VkBufferMemoryBarrier> bufferMemBs(2);
-		bufferMemBs[0].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-		bufferMemBs[0].buffer = m_staging->m_info.m_gpuHandle->m_buffer;
-		bufferMemBs[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		bufferMemBs[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-		bufferMemBs[0].offset = 0;
-		bufferMemBs[0].size = VK_WHOLE_SIZE;
-		bufferMemBs[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		bufferMemBs[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-
-		colorMemB.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-			0,
-			0, nullptr,
-			1, bufferMemBs.data(),
-			1, &colorMemB);
-
-		VkPipeline analysisPipeline;
-		VkPipelineLayout analysisPipelineLayout;
-		instance->m_surfaceAnalysisPipeline.GetVkPipeline(analysisPipeline, analysisPipelineLayout);
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, analysisPipeline);
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, analysisPipelineLayout, 0, 1, &m_staging->m_analysisDSet, 0, nullptr);
 		SurfaceAnalysisConstants surfConsts = {};
 		surfConsts.base = glm::uvec3(Engine::CHUNK_PADDING, Engine::CHUNK_PADDING, Engine::CHUNK_PADDING);
 		surfConsts.range = effectiveSize;
-		vkCmdPushConstants(commandBuffer, analysisPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SurfaceAnalysisConstants), &surfConsts);
-		vkCmdDispatch(commandBuffer,
-			(uint32_t)std::ceilf((surfConsts.range.x + 1) / 4.0f),
-			(uint32_t)std::ceilf((surfConsts.range.y + 1) / 4.0f),
-			(uint32_t)std::ceilf((surfConsts.range.z + 1) / 4.0f));
-
-		bufferMemBs[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		bufferMemBs[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		bufferMemBs[1] = bufferMemBs[0];
-		bufferMemBs[1].buffer = m_staging->m_infoStaging.m_gpuHandle->m_buffer;
-		bufferMemBs[1].srcAccessMask = 0;
-		bufferMemBs[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-			0,
-			0, nullptr,
-			2, bufferMemBs.data(),
-			0, nullptr);
-		VkBufferCopy attribCopy = {};
-		attribCopy.size = sizeof(SurfaceAnalysisInfo);
-		attribCopy.dstOffset = 0;
-		attribCopy.srcOffset = 0;
-		vkCmdCopyBuffer(commandBuffer, m_staging->m_info.m_gpuHandle->m_buffer, m_staging->m_infoStaging.m_gpuHandle->m_buffer, 1, &attribCopy);
-
-		bufferMemBs[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		bufferMemBs[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		bufferMemBs[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		bufferMemBs[1].dstAccessMask = VK_ACCESS_HOST_READ_BIT;
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-			0,
-			0, nullptr,
-			2, bufferMemBs.data(),
-			0, nullptr);
-
-		vkCmdSetEvent(commandBuffer, m_staging->m_analysisCompleteEvent, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		batch.AddAnalysis(m_staging, surfConsts);
+
+		//Assembled right behind the analysis, sized by it on the GPU
+		if (AllocateMesh(instance, SPECULATIVE_VERTEX_COUNT, SPECULATIVE_INDEX_COUNT))
+			batch.AddIndirectAssembly(m_staging, AssemblyConstants(m_staging, min, max));
 	}
 	else if (m_staging->m_stage == CHUNK_STAGE_VOLUME_ANALYSIS)
 	{
 		if (vkGetEventStatus(device, m_staging->m_analysisCompleteEvent) == VK_EVENT_RESET)
-			return;
+			return false;
 		vkResetEvent(device, m_staging->m_analysisCompleteEvent);
 
 		VmaAllocator allocator = instance->Allocator();
@@ -251,116 +188,176 @@ void VoxelChunk::Build(Engine* instance, VkCommandBuffer commandBuffer, float vo
 		std::memcpy(&surfaceAttribs, attribData, sizeof(SurfaceAnalysisInfo));
 		vmaUnmapMemory(allocator, m_staging->m_infoStaging.m_gpuHandle->m_allocation);
 
-		if (surfaceAttribs.cellCount > 0)
+		if (surfaceAttribs.cellCount == 0)
 		{
-			m_staging->m_stage = CHUNK_STAGE_VISUAL_ASSEMBLY;
-			m_staging->m_vertexCount = surfaceAttribs.vertexCount;
-			m_staging->m_indexCount = surfaceAttribs.indexCount;
-			m_staging->m_boundsMax = surfaceAttribs.max;
-			m_staging->m_boundsMin = surfaceAttribs.min;
-
-			m_staging->m_verticies.Dereference();
-			m_staging->m_verticies.m_byteCount = surfaceAttribs.vertexCount * 16LL;
-			m_staging->m_verticies.Allocate(instance);
-
-			m_staging->m_indicies.Dereference();
-			m_staging->m_indicies.m_byteCount = surfaceAttribs.indexCount * 4LL;
-			m_staging->m_indicies.Allocate(instance);
-
-			VkDescriptorBufferInfo vertBI = { m_staging->m_verticies.m_gpuHandle->m_buffer, 0, VK_WHOLE_SIZE };
-			VkDescriptorBufferInfo idxsBI = { m_staging->m_indicies.m_gpuHandle->m_buffer, 0, VK_WHOLE_SIZE };
-
-			std::vector<VkWriteDescriptorSet> descWrites(2);
-			descWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			descWrites[0].descriptorCount = 1;
-			descWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-			descWrites[0].dstArrayElement = 0;
-			descWrites[0].dstBinding = 0;
-			descWrites[0].pBufferInfo = &vertBI;
-			descWrites[1] = descWrites[0];
-			descWrites[1].dstBinding = 1;
-			descWrites[1].pBufferInfo = &idxsBI;
-
-			VkPipeline assemblyPipeline;
-			VkPipelineLayout assemblyPipelineLayout;
-			instance->m_surfaceAssemblyPipeline.GetVkPipeline(assemblyPipeline, assemblyPipelineLayout);
-			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, assemblyPipeline);
-			vkCmdPushDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, assemblyPipelineLayout, 1, 2, descWrites.data());
-			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, assemblyPipelineLayout, 0, 1, &m_staging->m_assemblyDSet, 0, nullptr);
-
-			SurfaceAssemblyConstants surfConsts = {};
-			surfConsts.base = glm::uvec3(Engine::CHUNK_PADDING, Engine::CHUNK_PADDING, Engine::CHUNK_PADDING);
-			surfConsts.offset = m_min;
-			surfConsts.scale = (m_max - m_min) / 
-				glm::vec3(m_staging->m_density.m_size.width, m_staging->m_density.m_size.height, m_staging->m_density.m_size.depth);
-			vkCmdPushConstants(commandBuffer, assemblyPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SurfaceAssemblyConstants), &surfConsts);
-			vkCmdDispatch(commandBuffer, (uint32_t)std::ceilf(surfaceAttribs.cellCount / 64.0f), 1, 1);
-
-			std::vector<VkBufferMemoryBarrier> bufferMemBs(2);
-			bufferMemBs[0].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-			bufferMemBs[0].buffer = m_staging->m_verticies.m_gpuHandle->m_buffer;
-			bufferMemBs[0].srcQueueFamilyIndex = instance->m_computeQueueFamily;
-			bufferMemBs[0].dstQueueFamilyIndex = instance->m_instance.queueFamilyIndex;
-			bufferMemBs[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-			bufferMemBs[0].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
-			bufferMemBs[0].offset = 0;
-			bufferMemBs[0].size = VK_WHOLE_SIZE;
-
-			bufferMemBs[1] = bufferMemBs[0];
-			bufferMemBs[1].buffer = m_staging->m_indicies.m_gpuHandle->m_buffer;
-			bufferMemBs[1].dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
-			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-				0,
-				0, nullptr,
-				2, bufferMemBs.data(),
-				0, nullptr);
-
-			vkCmdSetEvent(commandBuffer, m_staging->m_assemblyCompleteEvent, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-		}
-		else
-		{
-			//staging->m_density.Release(instance);
-			//staging->m_verticies.Release(instance);
-			//staging->m_indicies.Release(instance);
-			SAFE_TRASH(m_staging->m_density);
 			SAFE_TRASH(m_staging->m_verticies);
 			SAFE_TRASH(m_staging->m_indicies);
 			m_staging->m_stage = CHUNK_STAGE_IDLE;
 			ReleaseResources(instance, trash);
-			ReleaseSubResources(instance, trash);
-			m_built = true;
+			return true;
+		}
+
+		m_staging->m_vertexCount = surfaceAttribs.vertexCount;
+		m_staging->m_indexCount = surfaceAttribs.indexCount;
+		m_staging->m_boundsMax = surfaceAttribs.max;
+		m_staging->m_boundsMin = surfaceAttribs.min;
+
+		if (m_staging->m_verticies.m_gpuHandle &&
+			surfaceAttribs.vertexCount <= SPECULATIVE_VERTEX_COUNT &&
+			surfaceAttribs.indexCount <= SPECULATIVE_INDEX_COUNT)
+		{
+			instance->m_meshArena->Shrink(m_staging->m_verticies, (surfaceAttribs.vertexCount + VERTEX_HEADER_COUNT) * VERTEX_BYTE_SIZE);
+			instance->m_meshArena->Shrink(m_staging->m_indicies, surfaceAttribs.indexCount * IndexByteSize(surfaceAttribs.vertexCount));
+			return FinishAssembly(instance, batch, min, max, trash);
+		}
+
+		//Surface did not fit the reservation, assemble it again at its exact size
+		SAFE_TRASH(m_staging->m_verticies);
+		SAFE_TRASH(m_staging->m_indicies);
+		if (!AllocateMesh(instance, surfaceAttribs.vertexCount, surfaceAttribs.indexCount))
+		{
+			m_staging->m_stage = CHUNK_STAGE_IDLE;//Starts over next frame
+			return false;
 		}
+		m_staging->m_stage = CHUNK_STAGE_VISUAL_ASSEMBLY;
+		batch.AddAssembly(m_staging, AssemblyConstants(m_staging, min, max), surfaceAttribs.cellCount);
 	}
 	else if (m_staging->m_stage == CHUNK_STAGE_VISUAL_ASSEMBLY)
 	{
 		if (vkGetEventStatus(device, m_staging->m_assemblyCompleteEvent) == VK_EVENT_RESET)
-			return;
+			return false;
 		vkResetEvent(device, m_staging->m_assemblyCompleteEvent);
 
-		glm::vec3 vSize = (m_max - m_min) /
-			glm::vec3(m_staging->m_density.m_size.width, m_staging->m_density.m_size.height, m_staging->m_density.m_size.depth);
-		m_boundMin = m_min + vSize * glm::vec3(m_staging->m_boundsMin);
-		m_boundMax = m_min + vSize * glm::vec3(m_staging->m_boundsMax + 1U);
-
-		//m_densityImage.Release(instance);
-		//m_vertexBuffer.Release(instance);
-		//m_indexBuffer.Release(instance);
-		SAFE_TRASH(m_densityImage);
-		SAFE_TRASH(m_vertexBuffer);
-		SAFE_TRASH(m_indexBuffer);
-		m_densityImage = m_staging->m_density;
-		m_vertexBuffer = m_staging->m_verticies;
-		m_indexBuffer = m_staging->m_indicies;
-		m_vertexCount = m_staging->m_vertexCount;
-		m_indexCount = m_staging->m_indexCount;
-		m_staging->m_density.m_gpuHandle = nullptr;
-		m_staging->m_verticies.Dereference();
-		m_staging->m_indicies.Dereference();
-		m_staging->m_stage = CHUNK_STAGE_IDLE;
-
-		ReleaseStaging(instance);
-		m_built = true;
+		return FinishAssembly(instance, batch, min, max, trash);
 	}
+	else if (m_staging->m_stage == CHUNK_STAGE_MESH_READBACK)
+	{
+		if (vkGetEventStatus(device, m_staging->m_assemblyCompleteEvent) == VK_EVENT_RESET)
+			return false;
+		vkResetEvent(device, m_staging->m_assemblyCompleteEvent);
+
+		OptimizeMesh(instance);
+		m_staging->m_stage = CHUNK_STAGE_MESH_UPLOAD;
+		batch.AddMeshUpload(m_staging);
+	}
+	else if (m_staging->m_stage == CHUNK_STAGE_MESH_UPLOAD)
+	{
+		if (vkGetEventStatus(device, m_staging->m_assemblyCompleteEvent) == VK_EVENT_RESET)
+			return false;
+		vkResetEvent(device, m_staging->m_assemblyCompleteEvent);
+
+		CompleteBuild(instance, min, max, trash);
+		return true;
+	}
+	return false;
+}
+
+bool VoxelChunk::AllocateMesh(Engine* instance, uint32_t vertexCount, uint32_t indexCount)
+{
+	m_staging->m_verticies.Dereference();
+	m_staging->m_indicies.Dereference();
+	if (instance->m_meshArena->Allocate(instance, m_staging->m_verticies, (vertexCount + VERTEX_HEADER_COUNT) * VERTEX_BYTE_SIZE) &&
+		instance->m_meshArena->Allocate(instance, m_staging->m_indicies, indexCount * IndexByteSize(vertexCount)))
+		return true;
+
+	m_staging->m_verticies.Release(instance);
+	m_staging->m_indicies.Release(instance);
+	return false;
+}
+
+bool VoxelChunk::FinishAssembly(Engine* instance, ChunkBuildBatch& batch, const glm::vec3& min, const glm::vec3& max, std::vector<GPUResourceHandle*>& trash)
+{
+	if (!m_staging->m_optimize)
+	{
+		CompleteBuild(instance, min, max, trash);
+		return true;
+	}
+
+	VkDeviceSize byteCount = m_staging->m_verticies.m_byteCount + IndexRange(m_staging->m_indicies.m_byteCount);
+	GPUBuffer& meshStaging = m_staging->m_meshStaging;
+	if (meshStaging.m_gpuHandle && meshStaging.m_byteCount < byteCount)
+		meshStaging.Release(instance);
+	if (!meshStaging.m_gpuHandle)
+	{
+		meshStaging.m_bufferUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		meshStaging.m_memoryUsage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+		meshStaging.m_byteCount = byteCount;
+		meshStaging.m_recycle = true;
+		meshStaging.m_category = MEMORY_CATEGORY_STAGING;
+		meshStaging.Allocate(instance);
+	}
+	if (!meshStaging.Allocated())
+	{
+		meshStaging.Release(instance);
+		SAFE_TRASH(m_staging->m_verticies);
+		SAFE_TRASH(m_staging->m_indicies);
+		m_staging->m_stage = CHUNK_STAGE_IDLE;//Starts over next frame
+		return false;
+	}
+
+	m_staging->m_stage = CHUNK_STAGE_MESH_READBACK;
+	batch.AddMeshReadback(m_staging);
+	return false;
+}
+
+//Reordered in the host copy, vertices behind the header are moved to their first use and indices keep the width they were assembled with
+static thread_local MeshOptimizer t_meshOptimizer;
+static thread_local std::vector<uint32_t> t_meshIndices;
+static thread_local std::vector<uint32_t> t_meshRemap;
+static thread_local std::vector<uint64_t> t_meshVertices;
+
+void VoxelChunk::OptimizeMesh(Engine* instance)
+{
+	uint32_t vertexCount = m_staging->m_vertexCount;
+	uint32_t indexCount = m_staging->m_indexCount;
+	bool narrow = IndexType(vertexCount) == VK_INDEX_TYPE_UINT16;
+
+	VmaAllocator allocator = instance->Allocator();
+	VmaAllocation allocation = m_staging->m_meshStaging.m_gpuHandle->m_allocation;
+	void* data;
+	vmaMapMemory(allocator, allocation, &data);
+	vmaInvalidateAllocation(allocator, allocation, 0, VK_WHOLE_SIZE);
+	uint64_t* vertices = static_cast<uint64_t*>(data) + VERTEX_HEADER_COUNT;
+	void* indices = static_cast<uint8_t*>(data) + m_staging->m_verticies.m_byteCount;
+
+	t_meshIndices.resize(indexCount);
+	if (narrow)
+		std::copy(static_cast<uint16_t*>(indices), static_cast<uint16_t*>(indices) + indexCount, t_meshIndices.begin());
+	else
+		std::memcpy(t_meshIndices.data(), indices, indexCount * sizeof(uint32_t));
+
+	t_meshOptimizer.OptimizeVertexCache(t_meshIndices.data(), indexCount, vertexCount);
+	t_meshOptimizer.OptimizeVertexFetch(t_meshIndices.data(), indexCount, vertexCount, t_meshRemap);
+
+	t_meshVertices.assign(vertices, vertices + vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+		vertices[t_meshRemap[v]] = t_meshVertices[v];
+	if (narrow)
+		std::copy(t_meshIndices.begin(), t_meshIndices.end(), static_cast<uint16_t*>(indices));
+	else
+		std::memcpy(indices, t_meshIndices.data(), indexCount * sizeof(uint32_t));
+
+	vmaFlushAllocation(allocator, allocation, 0, VK_WHOLE_SIZE);
+	vmaUnmapMemory(allocator, allocation);
+}
+
+void VoxelChunk::CompleteBuild(Engine* instance, const glm::vec3& min, const glm::vec3& max, std::vector<GPUResourceHandle*>& trash)
+{
+	glm::vec3 vSize = (max - min) / glm::vec3(m_staging->m_volumeSize);
+	m_boundMin = min + vSize * glm::vec3(m_staging->m_boundsMin);
+	m_boundMax = min + vSize * glm::vec3(m_staging->m_boundsMax + 1U);
+
+	SAFE_TRASH(m_vertexBuffer);
+	SAFE_TRASH(m_indexBuffer);
+	m_vertexBuffer = m_staging->m_verticies;
+	m_indexBuffer = m_staging->m_indicies;
+	m_vertexCount = m_staging->m_vertexCount;
+	m_indexCount = m_staging->m_indexCount;
+	m_staging->m_verticies.Dereference();
+	m_staging->m_indicies.Dereference();
+	m_staging->m_stage = CHUNK_STAGE_IDLE;
+
+	ReleaseStaging(instance);
 }
 
 ChunkStagingResources::ChunkStagingResources(Engine* instance, uint8_t size, uint8_t padding)
@@ -374,14 +371,17 @@ ChunkStagingResources::ChunkStagingResources(Engine* instance, uint8_t size, uin
 
 	m_info.m_bufferUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
 		VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+		VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
 	m_info.m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
-	m_info.m_byteCount = sizeof(SurfaceAnalysisInfo);
+	m_info.m_byteCount = AnalysisInfoByteCount(size);
+	m_info.m_category = MEMORY_CATEGORY_STAGING;
 	m_info.Allocate(instance);
 	
 	m_infoStaging.m_bufferUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 	m_infoStaging.m_memoryUsage = VMA_MEMORY_USAGE_GPU_TO_CPU;
 	m_infoStaging.m_byteCount = sizeof(SurfaceAnalysisInfo);
+	m_infoStaging.m_category = MEMORY_CATEGORY_STAGING;
 	m_infoStaging.Allocate(instance);
 
 	uint32_t sizeP1 = (uint32_t)size + 1;
@@ -391,6 +391,7 @@ ChunkStagingResources::ChunkStagingResources(Engine* instance, uint8_t size, uin
 	m_indexMap.m_usage = VK_IMAGE_USAGE_STORAGE_BIT;
 	m_indexMap.m_type = VK_IMAGE_TYPE_3D;
 	m_indexMap.m_viewType = VK_IMAGE_VIEW_TYPE_3D;
+	m_indexMap.m_category = MEMORY_CATEGORY_STAGING;
 	m_indexMap.Allocate(instance);
 
 	uint32_t sizePad = sizeP1 + (uint32_t)padding * 2;
@@ -400,25 +401,23 @@ ChunkStagingResources::ChunkStagingResources(Engine* instance, uint8_t size, uin
 	m_colorMap.m_type = VK_IMAGE_TYPE_3D;
 	m_colorMap.m_viewType = VK_IMAGE_VIEW_TYPE_3D;
 	m_colorMap.m_usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	m_colorMap.m_category = MEMORY_CATEGORY_STAGING;
 	m_colorMap.Allocate(instance);
 
 	m_cells.m_bufferUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 	m_cells.m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
 	m_cells.m_byteCount = (uint64_t)sizeP1 * sizeP1 * sizeP1 * sizeof(uint32_t) * 2;
+	m_cells.m_category = MEMORY_CATEGORY_STAGING;
 	m_cells.Allocate(instance);
 
-	m_verticies.m_bufferUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-	m_verticies.m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
-
-	m_indicies.m_bufferUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-	m_indicies.m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
-
-	m_density.m_format = VK_FORMAT_R8_UNORM;
-	m_density.m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
-	m_density.m_tiling = VK_IMAGE_TILING_OPTIMAL;
-	m_density.m_type = VK_IMAGE_TYPE_3D;
-	m_density.m_viewType = VK_IMAGE_VIEW_TYPE_3D;
-	m_density.m_usage = VK_IMAGE_USAGE_STORAGE_BIT;
+	VmaAllocationInfo allocInfo;
+#define ADD_BYTES(res) if (res.Allocated()) { vmaGetAllocationInfo(instance->Allocator(), res.m_gpuHandle->m_allocation, &allocInfo); m_byteCount += allocInfo.size; }
+	ADD_BYTES(m_info);
+	ADD_BYTES(m_infoStaging);
+	ADD_BYTES(m_indexMap);
+	ADD_BYTES(m_colorMap);
+	ADD_BYTES(m_cells);
+#undef ADD_BYTES
 }
 
 void ChunkStagingResources::WriteDescriptors(Engine* instance,
@@ -504,9 +503,18 @@ void ChunkStagingResources::GetImageTransferBarriers(VkImageMemoryBarrier& color
 	indexBarrier.image = m_indexMap.m_gpuHandle->m_image;
 }
 
-bool ChunkStagingResources::Ready(Engine* instance, VkCommandBuffer commandBuffer)
+bool ChunkStagingResources::Ready(Engine* instance, ChunkBuildBatch& batch)
 {
 	VkDevice device = instance->Device();
+	if (!m_layoutReady)
+	{
+		VkImageMemoryBarrier colorBarrier = {};
+		VkImageMemoryBarrier indexBarrier = {};
+		GetImageTransferBarriers(colorBarrier, indexBarrier);
+		batch.AddLayoutTransition(colorBarrier, indexBarrier);
+		m_layoutReady = true;
+	}
+
 	if (m_reset)
 	{
 		if (m_stage == CHUNK_STAGE_VOLUME_ANALYSIS)
@@ -514,6 +522,8 @@ bool ChunkStagingResources::Ready(Engine* instance, VkCommandBuffer commandBuffe
 			if (vkGetEventStatus(device, m_analysisCompleteEvent) == VK_EVENT_RESET)
 				return false;
 			vkResetEvent(device, m_analysisCompleteEvent);
+			m_verticies.Release(instance);
+			m_indicies.Release(instance);
 		}
 		else if (m_stage == CHUNK_STAGE_VISUAL_ASSEMBLY)
 		{
@@ -522,7 +532,14 @@ bool ChunkStagingResources::Ready(Engine* instance, VkCommandBuffer commandBuffe
 			vkResetEvent(device, m_assemblyCompleteEvent);
 			m_verticies.Release(instance);
 			m_indicies.Release(instance);
-			m_density.Release(instance);
+		}
+		else if (m_stage == CHUNK_STAGE_MESH_READBACK || m_stage == CHUNK_STAGE_MESH_UPLOAD)
+		{
+			if (vkGetEventStatus(device, m_assemblyCompleteEvent) == VK_EVENT_RESET)
+				return false;
+			vkResetEvent(device, m_assemblyCompleteEvent);
+			m_verticies.Release(instance);
+			m_indicies.Release(instance);
 		}
 		m_stage = CHUNK_STAGE_IDLE;
 		m_reset = false;
@@ -533,6 +550,11 @@ bool ChunkStagingResources::Ready(Engine* instance, VkCommandBuffer commandBuffe
 void ChunkStagingResources::Deallocate(Engine* instance)
 {
 	VkDevice device = instance->Device();
+	if (m_descriptorPool && instance->m_stagingPool)//Otherwise the pool was released along with its sets
+	{
+		VkDescriptorSet sets[3] = { m_formDSet, m_analysisDSet, m_assemblyDSet };
+		instance->m_stagingPool->FreeDescriptorSets(instance, m_descriptorPool, sets);
+	}
 	vkDestroyEvent(device, m_analysisCompleteEvent, nullptr);
 	vkDestroyEvent(device, m_assemblyCompleteEvent, nullptr);
 	m_colorMap.m_gpuHandle->Deallocate(instance);
@@ -543,7 +565,7 @@ void ChunkStagingResources::Deallocate(Engine* instance)
 #define SAFE_DEALLOC(res) if(res.m_gpuHandle) res.m_gpuHandle->Deallocate(instance)
 	SAFE_DEALLOC(m_verticies);
 	SAFE_DEALLOC(m_indicies);
-	SAFE_DEALLOC(m_density);
+	SAFE_DEALLOC(m_meshStaging);
 #undef SAFE_DEALLOC
 }
 
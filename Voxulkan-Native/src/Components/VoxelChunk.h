@@ -5,12 +5,14 @@
 #include "..//Resources/ComputePipeline.h"
 
 class Engine;
+class ChunkBuildBatch;
 
 struct ChunkRenderPackage
 {
 	GPUBufferHandle* vertexBuffer = nullptr;
 	GPUBufferHandle* indexBuffer = nullptr;
 	int indexCount = 0;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
 	glm::vec3 min = {};
 	glm::vec3 max = {};
 
@@ -30,8 +32,40 @@ struct SurfaceAnalysisInfo
 	uint32_t indexCount;
 	glm::uvec3 max;
 	glm::uvec3 min;
+	glm::uvec3 assemblyGroups;//VkDispatchIndirectCommand of the assembly, one group per 64 cells
 };
 
+//SurfaceAnalysisInfo followed by the tile ticket and three status words per analysis workgroup, see SurfaceAnalysis.comp
+inline VkDeviceSize AnalysisInfoByteCount(uint32_t chunkSize)
+{
+	VkDeviceSize tiles = (chunkSize + 1U + 3U) / 4U;
+	return sizeof(SurfaceAnalysisInfo) + sizeof(uint32_t) * (1U + 3U * tiles * tiles * tiles);
+}
+
+//Mesh room reserved before analysis so assembly can run in the same submission.
+//Surfaces that do not fit are assembled again once their exact size was read back.
+#define SPECULATIVE_VERTEX_COUNT 8192U
+#define SPECULATIVE_INDEX_COUNT 32768U
+#define VERTEX_BYTE_SIZE 8ULL //Chunk local 6.6 fixed point position, octahedral normal and material, see SurfaceAssembly.comp
+#define VERTEX_HEADER_COUNT 3ULL //Vertex slots in front of a chunk's vertices holding the offset and scale that decode its positions
+#define INDEX_BYTE_SIZE 4ULL
+#define NARROW_INDEX_VERTEX_LIMIT 65535U //Surfaces with at most this many vertices get 16 bit indices
+
+inline VkIndexType IndexType(uint32_t vertexCount)
+{
+	return vertexCount <= NARROW_INDEX_VERTEX_LIMIT ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+inline VkDeviceSize IndexByteSize(uint32_t vertexCount)
+{
+	return vertexCount <= NARROW_INDEX_VERTEX_LIMIT ? 2ULL : INDEX_BYTE_SIZE;
+}
+//Index ranges are bound and cleared in whole words
+inline VkDeviceSize IndexRange(VkDeviceSize byteCount)
+{
+	VkDeviceSize range = (byteCount + 3ULL) & ~3ULL;
+	return range > INDEX_BYTE_SIZE ? range : INDEX_BYTE_SIZE;
+}
+
 struct ChunkPipelineConstants
 {
 	glm::mat4x4 mvp = {};
@@ -40,11 +74,47 @@ struct ChunkPipelineConstants
 	float tessellationFactor = 0.0f;
 };
 
+//Input of ChunkCull.comp, one per chunk handed to the draw
+struct ChunkCullRecord
+{
+	glm::vec3 min = {};
+	uint32_t body = 0;
+	glm::vec3 max = {};
+	uint32_t run = 0;
+	uint32_t indexCount = 0;
+	uint32_t firstIndex = 0;
+	int32_t vertexOffset = 0;
+	uint32_t runFirst = 0;
+};
+
+struct ChunkCullConstants
+{
+	uint32_t chunkCount = 0;
+	uint32_t compact = 0;
+	uint32_t levelCount = 0;
+	uint32_t padding = 0;
+	glm::uvec2 pyramidSize = {};
+};
+
+struct DepthPyramidConstants
+{
+	glm::ivec2 srcOffset = {};
+	glm::ivec2 srcSize = {};
+	glm::ivec2 dstOffset = {};
+	glm::ivec2 dstSize = {};
+	uint32_t fromSource = 0;
+};
+
 struct BodyForm
 {
 	glm::vec3 min;
 	glm::vec3 max;
 	ComputePipeline* formCompute;
+	//Optional bound of the surface the form writes, a shell around shellCenter in body space: density is positive beyond shellOuter and negative within shellInner.
+	//Lets traversal finish chunks without a surface before they take staging, shellOuter <= shellInner gives no bound.
+	glm::vec3 shellCenter;
+	float shellInner;
+	float shellOuter;
 };
 
 struct FormConstants
@@ -66,6 +136,8 @@ struct SurfaceAssemblyConstants
 	alignas(16)glm::uvec3 base;
 	alignas(16)glm::vec3 offset;
 	alignas(16)glm::vec3 scale;
+	uint32_t vertexCapacity;//Assembly is skipped when the analysed surface does not fit
+	uint32_t indexCapacity;
 };
 
 typedef enum ChunkStage
@@ -73,6 +145,8 @@ typedef enum ChunkStage
 	CHUNK_STAGE_IDLE = 0,
 	CHUNK_STAGE_VOLUME_ANALYSIS = 1,
 	CHUNK_STAGE_VISUAL_ASSEMBLY = 2,
+	CHUNK_STAGE_MESH_READBACK = 3,
+	CHUNK_STAGE_MESH_UPLOAD = 4,
 } VoxelChunkState;
 
 struct ChunkStagingResources : public GPUResourceHandle
@@ -80,11 +154,14 @@ struct ChunkStagingResources : public GPUResourceHandle
 	ChunkStagingResources(Engine* instance, uint8_t size, uint8_t padding);
 
 	ChunkStage m_stage = CHUNK_STAGE_IDLE;
+	bool m_optimize = false;//Mesh is reordered by MeshOptimizer before the chunk shows it, fixed when the build starts
 
 	//Staging
 	VkDescriptorSet m_formDSet = VK_NULL_HANDLE;
 	VkDescriptorSet m_analysisDSet = VK_NULL_HANDLE;
 	VkDescriptorSet m_assemblyDSet = VK_NULL_HANDLE;
+	VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;//Owner of the sets, see ChunkStagingPool
+	uint64_t m_byteCount = 0;//Device memory of the staging images and buffers
 
 	GPUImage m_colorMap = {};
 	GPUImage m_indexMap = {};
@@ -92,10 +169,11 @@ struct ChunkStagingResources : public GPUResourceHandle
 	GPUBuffer m_info = {};
 	GPUBuffer m_infoStaging = {};
 	VkEvent m_analysisCompleteEvent = VK_NULL_HANDLE;
-	VkEvent m_assemblyCompleteEvent = VK_NULL_HANDLE;
+	VkEvent m_assemblyCompleteEvent = VK_NULL_HANDLE;//Also signals the mesh copies of an optimized build
+	GPUBuffer m_meshStaging = {};//Host copy of a mesh being optimized, grown on demand and not counted in m_byteCount
 
-	//Output
-	GPUImage m_density = {};
+	//Output, the density lives in m_colorMap only while the chunk is built, see VoxelChunk
+	glm::uvec3 m_volumeSize = {};//Voxels of the built volume without padding
 	GPUBuffer m_verticies = {};
 	GPUBuffer m_indicies = {};
 	uint32_t m_vertexCount = 0;
@@ -109,23 +187,22 @@ struct ChunkStagingResources : public GPUResourceHandle
 		VkDescriptorSet assemblyDSet);
 	void GetImageTransferBarriers(VkImageMemoryBarrier& colorBarrier, VkImageMemoryBarrier& indexBarrier);
 	void Deallocate(Engine* instance) override;
-	bool Ready(Engine* instance, VkCommandBuffer commandBuffer);
+	//False if any staging image or buffer failed to allocate
+	inline bool Allocated() const { return m_colorMap.Allocated() && m_indexMap.Allocated() && m_cells.Allocated() && m_info.Allocated() && m_infoStaging.Allocated(); }
+	bool Ready(Engine* instance, ChunkBuildBatch& batch);
 	inline void Reset() { m_reset = true; }
 private:
 	bool m_reset = false;
+	bool m_layoutReady = false;//Images are moved to VK_IMAGE_LAYOUT_GENERAL by the first build using them
 };
 
+//GPU side of an octree node, bounds and hierarchy live in VoxelNodePool.
+//Only the mesh stays resident, the density is discarded once it is meshed and rebuilt from the body's forms when needed again.
 struct VoxelChunk
 {
 	friend class VoxelBody;
+	friend class ChunkBuildQueue;
 
-	VoxelChunk();
-
-	glm::vec3 m_min = {};
-	glm::vec3 m_max = {};
-	std::vector<VoxelChunk> m_subChunks = {};
-
-	GPUImage m_densityImage = {};
 	GPUBuffer m_indexBuffer = {};
 	GPUBuffer m_vertexBuffer = {};
 	uint32_t m_vertexCount = 0;
@@ -136,21 +213,20 @@ struct VoxelChunk
 	void SetMeshData(const GPUBuffer& vertexBuffer, const GPUBuffer& indexBuffer, uint32_t vertexCount, uint32_t indexCount);
 	void ReleaseResources(Engine* instance, std::vector<GPUResourceHandle*>& trash);
 	void ReleaseStaging(Engine* instance);
-	void ReleaseSubResources(Engine* instance, std::vector<GPUResourceHandle*>& trash);
-	void AllocateVolume(Engine* instance, const glm::uvec3& size);
-	inline void UpdateDistance(glm::vec3 observerPosition)
-	{
-		glm::vec3 delta = observerPosition - glm::clamp(observerPosition, m_min, m_max);
-		m_distance = delta.x * delta.x + delta.y * delta.y + delta.z * delta.z;
-	}
-	bool operator<(const VoxelChunk& rhs)const
-	{
-		return m_distance < rhs.m_distance;
-	}
 private:
-	void Build(Engine* instance, VkCommandBuffer commandBuffer, float voxelSize, BodyForm* forms, uint32_t formsCount, std::vector<GPUResourceHandle*>& trash);
+	//Returns true once the chunk holds its final mesh (or is known to be empty), needs staging granted by ChunkBuildQueue.
+	//GPU work of the next stage is added to batch and recorded once the traversal is done.
+	bool Build(Engine* instance, ChunkBuildBatch& batch, const glm::vec3& min, const glm::vec3& max, float voxelSize, BodyForm* forms, uint32_t formsCount, std::vector<GPUResourceHandle*>& trash);
+	//Volume the forms write for the chunk, padded bounds included
+	static glm::uvec3 VolumeSize(const glm::vec3& min, const glm::vec3& max, float voxelSize, glm::vec3& pMin, glm::vec3& pMax);
+	//Conservative check on the form shells, true if the padded volume is known to hold no surface and the chunk needs no build
+	static bool SurfaceFree(const glm::vec3& min, const glm::vec3& max, float voxelSize, const BodyForm* forms, uint32_t formsCount);
+
+	bool AllocateMesh(Engine* instance, uint32_t vertexCount, uint32_t indexCount);
+	//Completes the build unless the mesh is optimized first, returns true if it did
+	bool FinishAssembly(Engine* instance, ChunkBuildBatch& batch, const glm::vec3& min, const glm::vec3& max, std::vector<GPUResourceHandle*>& trash);
+	void OptimizeMesh(Engine* instance);
+	void CompleteBuild(Engine* instance, const glm::vec3& min, const glm::vec3& max, std::vector<GPUResourceHandle*>& trash);
 
-	bool m_built = false;
 	ChunkStagingResources* m_staging = nullptr;
-	float m_distance = 0.0f;
 };
\ No newline at end of file
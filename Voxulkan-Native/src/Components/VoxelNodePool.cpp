@@ -0,0 +1,149 @@
+#include "VoxelNodePool.h"
+#include "..//Plugin.h"
+
+VoxelNodePool::VoxelNodePool()
+{
+	for (uint32_t i = 0; i < NODE_FREE_LISTS; i++)
+		m_freeBlocks[i] = NULL_NODE;
+}
+
+template<typename T>
+static void DeletePageArray(T*& array, NodeIndex base)
+{
+	if (array) delete[] (array + base);
+	array = nullptr;
+}
+
+VoxelNodePool::~VoxelNodePool()
+{
+	for (uint32_t i = 0; i < NODE_MAX_PAGES; i++)
+	{
+		NodePage& page = m_pages[i];
+		NodeIndex base = PageBase(i);
+		DeletePageArray(page.min, base);
+		DeletePageArray(page.max, base);
+		DeletePageArray(page.distance, base);
+		DeletePageArray(page.flags, base);
+		DeletePageArray(page.firstChild, base);
+		DeletePageArray(page.childCount, base);
+		DeletePageArray(page.childOrder, base);
+		DeletePageArray(page.chunks, base);
+		DeletePageArray(page.cacheEpoch, base);
+		DeletePageArray(page.settledUntil, base);
+		DeletePageArray(page.renderBegin, base);
+		DeletePageArray(page.renderCount, base);
+	}
+}
+
+void VoxelNodePool::AllocatePage(uint32_t page)
+{
+	uint32_t size = PageSize(page);
+	NodeIndex base = PageBase(page);
+	NodePage& p = m_pages[page];
+	p.min = new glm::vec3[size]() - base;
+	p.max = new glm::vec3[size]() - base;
+	p.distance = new float[size]() - base;
+	p.flags = new uint8_t[size]() - base;
+	p.firstChild = new NodeIndex[size]() - base;
+	p.childCount = new uint32_t[size]() - base;
+	p.childOrder = new uint32_t[size]() - base;
+	p.chunks = new VoxelChunk[size]() - base;
+	p.cacheEpoch = new uint32_t[size]() - base;
+	p.settledUntil = new double[size]() - base;
+	p.renderBegin = new uint32_t[size]() - base;
+	p.renderCount = new uint32_t[size]() - base;
+	m_capacity += size;
+}
+
+NodeIndex VoxelNodePool::PopFreeBlock(uint32_t count)
+{
+	//Lists of small blocks only hold their size, the shared list is searched for an exact fit
+	NodeIndex* link = &m_freeBlocks[count < NODE_FREE_LISTS ? count : 0];
+	while (*link != NULL_NODE)
+	{
+		NodeIndex block = *link;
+		if (ChildCount(block) == count)
+		{
+			*link = FirstChild(block);
+			return block;
+		}
+		link = &FirstChild(block);
+	}
+	return NULL_NODE;
+}
+
+NodeIndex VoxelNodePool::AllocateBlock(uint32_t count)
+{
+	if (count == 0 || count > NODE_MAX_BLOCK)
+	{
+		LOG("Node block of " + std::to_string(count) + " is larger than NODE_MAX_BLOCK");
+		return NULL_NODE;
+	}
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	NodeIndex first = PopFreeBlock(count);
+	while (first == NULL_NODE)
+	{
+		uint32_t page = PageIndex(m_next);
+		if (page >= NODE_MAX_PAGES)
+		{
+			LOG("Voxel node pool is full");
+			return NULL_NODE;
+		}
+
+		//Blocks never straddle pages, pages too small for the block are skipped without being allocated
+		NodeIndex end = PageBase(page) + PageSize(page);
+		if (m_next + count > end)
+		{
+			m_next = end;
+			continue;
+		}
+
+		if (!m_pages[page].min)
+			AllocatePage(page);
+		first = m_next;
+		m_next += count;
+	}
+
+	NodePage& page = Page(first);
+	for (NodeIndex i = first; i < first + count; i++)
+	{
+		page.distance[i] = 0.0f;
+		page.flags[i] = NODE_FLAG_NONE;
+		page.firstChild[i] = NULL_NODE;
+		page.childCount[i] = 0;
+		page.childOrder[i] = NODE_ORDER_IDENTITY;
+		page.cacheEpoch[i] = 0;
+	}
+
+	m_liveCount += count;
+	return first;
+}
+
+void VoxelNodePool::FreeBlock(NodeIndex first, uint32_t count)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	NodeIndex& list = m_freeBlocks[count < NODE_FREE_LISTS ? count : 0];
+	FirstChild(first) = list;
+	ChildCount(first) = count;
+	list = first;
+	m_liveCount -= count;
+}
+
+void VoxelNodePool::ReleaseChildren(Engine* instance, NodeIndex node, std::vector<GPUResourceHandle*>& trash)
+{
+	NodeIndex first = FirstChild(node);
+	if (first == NULL_NODE)
+		return;
+
+	uint32_t count = ChildCount(node);
+	for (NodeIndex i = first; i < first + count; i++)
+	{
+		Chunk(i).ReleaseResources(instance, trash);
+		ReleaseChildren(instance, i, trash);
+	}
+
+	FreeBlock(first, count);
+	FirstChild(node) = NULL_NODE;
+	ChildCount(node) = 0;
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include "VoxelChunk.h"
+#include <mutex>
+#include <atomic>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+typedef uint32_t NodeIndex;
+#define NULL_NODE 0xFFFFFFFFU
+
+typedef enum NodeFlags
+{
+	NODE_FLAG_NONE = 0,
+	NODE_FLAG_BUILT = 1,
+} NodeFlags;
+
+#define NODE_PAGE_BITS 6 //The first page holds 64 nodes, every later page doubles the pool
+#define NODE_FIRST_PAGE_SIZE (1U << NODE_PAGE_BITS)
+#define NODE_FIRST_PAGE_MASK (NODE_FIRST_PAGE_SIZE - 1U)
+#define NODE_MAX_PAGES 19 //Up to 1 << 24 nodes
+#define NODE_MAX_BLOCK 4096U
+#define NODE_FREE_LISTS 64 //Freed blocks are listed by size, larger ones share the first list
+#define NODE_ORDER_MAX_CHILDREN 8 //Child orders are packed 4 bits per child
+#define NODE_ORDER_IDENTITY 0x76543210U
+
+//Flat storage for the octree of a VoxelBody.
+//Traversal only touches the dense per-node arrays, the GPU side of a node lives in chunks.
+//Children of a node occupy one contiguous block which is recycled when the branch merges.
+//Pages never move once allocated so subtrees can be split and merged from several threads.
+//Page k > 0 holds the nodes [NODE_FIRST_PAGE_SIZE << (k - 1), NODE_FIRST_PAGE_SIZE << k), so small bodies stay small.
+class VoxelNodePool
+{
+public:
+	VoxelNodePool();
+	~VoxelNodePool();
+	VoxelNodePool(const VoxelNodePool&) = delete;
+	VoxelNodePool& operator=(const VoxelNodePool&) = delete;
+
+	NodeIndex AllocateBlock(uint32_t count);
+	void FreeBlock(NodeIndex first, uint32_t count);
+	void ReleaseChildren(Engine* instance, NodeIndex node, std::vector<GPUResourceHandle*>& trash);
+
+	inline glm::vec3& Min(NodeIndex node) { return Page(node).min[node]; }
+	inline glm::vec3& Max(NodeIndex node) { return Page(node).max[node]; }
+	inline float& Distance(NodeIndex node) { return Page(node).distance[node]; }
+	inline uint8_t& Flags(NodeIndex node) { return Page(node).flags[node]; }
+	inline NodeIndex& FirstChild(NodeIndex node) { return Page(node).firstChild[node]; }
+	inline uint32_t& ChildCount(NodeIndex node) { return Page(node).childCount[node]; }
+	inline uint32_t& ChildOrder(NodeIndex node) { return Page(node).childOrder[node]; }//Last front to back order of the children
+	inline VoxelChunk& Chunk(NodeIndex node) { return Page(node).chunks[node]; }
+
+	//Incremental traversal cache, see VoxelBody::m_incremental
+	inline uint32_t& CacheEpoch(NodeIndex node) { return Page(node).cacheEpoch[node]; }
+	inline double& SettledUntil(NodeIndex node) { return Page(node).settledUntil[node]; }
+	inline uint32_t& RenderBegin(NodeIndex node) { return Page(node).renderBegin[node]; }
+	inline uint32_t& RenderCount(NodeIndex node) { return Page(node).renderCount[node]; }
+
+	inline void UpdateDistance(NodeIndex node, const glm::vec3& observerPosition)
+	{
+		NodePage& page = Page(node);
+		glm::vec3 delta = observerPosition - glm::clamp(observerPosition, page.min[node], page.max[node]);
+		page.distance[node] = delta.x * delta.x + delta.y * delta.y + delta.z * delta.z;
+	}
+
+	inline bool IsBuilt(NodeIndex node) { return (Flags(node) & NODE_FLAG_BUILT) != 0; }
+	inline void SetBuilt(NodeIndex node, bool built)
+	{
+		uint8_t& flags = Flags(node);
+		flags = built ? (flags | NODE_FLAG_BUILT) : (flags & ~NODE_FLAG_BUILT);
+	}
+
+	inline size_t Capacity() const { return m_capacity; }
+	inline size_t LiveCount() const { return m_liveCount; }
+
+private:
+	//Per node arrays of one page, allocated together with the page and never moved.
+	//Each pointer is offset by the page's first node so the arrays are indexed by the node itself.
+	struct NodePage
+	{
+		glm::vec3* min = nullptr;
+		glm::vec3* max = nullptr;
+		float* distance = nullptr;
+		uint8_t* flags = nullptr;
+		NodeIndex* firstChild = nullptr;
+		uint32_t* childCount = nullptr;
+		uint32_t* childOrder = nullptr;
+		VoxelChunk* chunks = nullptr;
+		uint32_t* cacheEpoch = nullptr;
+		double* settledUntil = nullptr;
+		uint32_t* renderBegin = nullptr;
+		uint32_t* renderCount = nullptr;
+	};
+
+	static inline uint32_t HighestBit(uint32_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse(&index, value);
+		return index;
+#else
+		return 31 - __builtin_clz(value);
+#endif
+	}
+	static inline uint32_t PageIndex(NodeIndex node) { return HighestBit(node | NODE_FIRST_PAGE_MASK) - (NODE_PAGE_BITS - 1); }
+	static inline NodeIndex PageBase(uint32_t page) { return page == 0 ? 0 : NODE_FIRST_PAGE_SIZE << (page - 1); }
+	static inline uint32_t PageSize(uint32_t page) { return page == 0 ? NODE_FIRST_PAGE_SIZE : NODE_FIRST_PAGE_SIZE << (page - 1); }
+	inline NodePage& Page(NodeIndex node) { return m_pages[PageIndex(node)]; }
+
+	void AllocatePage(uint32_t page);
+	NodeIndex PopFreeBlock(uint32_t count);
+
+	NodePage m_pages[NODE_MAX_PAGES] = {};
+	size_t m_capacity = 0;
+	NodeIndex m_next = 0;
+
+	//Freed blocks are linked through the FirstChild of their first node, which also keeps the block size in ChildCount
+	std::mutex m_lock;
+	NodeIndex m_freeBlocks[NODE_FREE_LISTS];
+	std::atomic<size_t> m_liveCount = { 0 };
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define DISTANCE_ORDER_INSERTION_LIMIT 32 //Shorter lists are insertion sorted on the exact distance
+
+//Coarse sort key of a non negative distance, the exponent and the upper 8 mantissa bits.
+//Close distances share a key and keep their incoming order, front to back drawing does not need more.
+inline uint16_t DistanceKey(float distance)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &distance, sizeof(bits));
+	return (uint16_t)((bits & 0x7FFFFFFFU) >> 15);
+}
+
+//Stable insertion sort, linear when the input is nearly in order already
+template <typename T, typename Less>
+inline void InsertionSort(T* data, size_t count, Less less)
+{
+	for (size_t i = 1; i < count; i++)
+	{
+		T value = data[i];
+		size_t j = i;
+		for (; j > 0 && less(value, data[j - 1]); j--)
+			data[j] = data[j - 1];
+		data[j] = value;
+	}
+}
+
+//Orders indices front to back by distances[index], stable and linear in count.
+//Two byte wide radix passes over the distance keys, scratch is reused between calls.
+inline void SortByDistance(const float* distances, uint32_t* indices, size_t count, std::vector<uint32_t>& scratch)
+{
+	if (count < DISTANCE_ORDER_INSERTION_LIMIT)
+	{
+		InsertionSort(indices, count, [distances](uint32_t a, uint32_t b) { return distances[a] < distances[b]; });
+		return;
+	}
+
+	uint32_t histogram[2][257] = {};
+	for (size_t i = 0; i < count; i++)
+	{
+		uint16_t key = DistanceKey(distances[indices[i]]);
+		histogram[0][(key & 0xFF) + 1]++;
+		histogram[1][(key >> 8) + 1]++;
+	}
+	for (uint32_t b = 0; b < 256; b++)
+	{
+		histogram[0][b + 1] += histogram[0][b];
+		histogram[1][b + 1] += histogram[1][b];
+	}
+
+	scratch.resize(count);
+	for (size_t i = 0; i < count; i++)
+		scratch[histogram[0][DistanceKey(distances[indices[i]]) & 0xFF]++] = indices[i];
+	for (size_t i = 0; i < count; i++)
+		indices[histogram[1][DistanceKey(distances[scratch[i]]) >> 8]++] = scratch[i];
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Lock free retire lists for deferred destruction, one per retiring thread.
+//Items are retired in batches tagged with the epoch (frame) they were retired in, a thread only touches its own open batch
+//and hands it over with a single atomic exchange, so retiring never waits on other threads or on the collector.
+//A single collector gathers the batches and reclaims whole batches once their epoch is safe, work is proportional to what it frees.
+template <typename T>
+class EpochGarbage
+{
+public:
+	EpochGarbage() : m_id(s_nextId.fetch_add(1, std::memory_order_relaxed)) {}
+	~EpochGarbage()
+	{
+		RetireList* list = m_lists.load(std::memory_order_acquire);
+		while (list)
+		{
+			RetireList* next = list->next;
+			delete list->open.load(std::memory_order_relaxed);
+			delete list->spare.load(std::memory_order_relaxed);
+			delete list;
+			list = next;
+		}
+		DeleteChain(m_sealed.load(std::memory_order_acquire));
+		for (Batch* batch : m_pending)
+			delete batch;
+	}
+
+	void Retire(const T& item, uint64_t epoch)
+	{
+		Batch* batch = Claim(epoch);
+		batch->items.push_back(item);
+		Release(batch);
+	}
+
+	void Retire(const std::vector<T>& items, uint64_t epoch)
+	{
+		if (items.empty())
+			return;
+		Batch* batch = Claim(epoch);
+		batch->items.insert(batch->items.end(), items.begin(), items.end());
+		Release(batch);
+	}
+
+	//Collector side, reclaim(item) runs for every item retired in an epoch <= safeEpoch
+	template <typename Reclaim>
+	void Collect(uint64_t safeEpoch, Reclaim reclaim)
+	{
+		Gather();
+		size_t kept = 0;
+		for (size_t i = 0; i < m_pending.size(); i++)
+		{
+			Batch* batch = m_pending[i];
+			if (batch->epoch > safeEpoch)
+			{
+				m_pending[kept++] = batch;
+				continue;
+			}
+			for (const T& item : batch->items)
+				reclaim(item);
+			Recycle(batch);
+		}
+		m_pending.resize(kept);
+	}
+
+	//Reclaims everything retired so far regardless of epoch, retiring threads must be idle
+	template <typename Reclaim>
+	void CollectAll(Reclaim reclaim)
+	{
+		Collect(UINT64_MAX, reclaim);
+	}
+
+private:
+	struct RetireList;
+
+	struct Batch
+	{
+		uint64_t epoch = 0;
+		std::vector<T> items = {};
+		Batch* next = nullptr;
+		RetireList* owner = nullptr;
+	};
+
+	//Owned by one thread, the collector only ever takes open away or puts a spare back
+	struct RetireList
+	{
+		std::atomic<Batch*> open = { nullptr };
+		std::atomic<Batch*> spare = { nullptr };
+		RetireList* next = nullptr;
+	};
+
+	RetireList* ThreadList()
+	{
+		//Keyed by id rather than address, a new container at a freed one's address must not reuse its list
+		thread_local uint64_t t_id = 0;
+		thread_local RetireList* t_list = nullptr;
+		if (t_id != m_id)
+		{
+			t_list = new RetireList();
+			t_list->next = m_lists.load(std::memory_order_relaxed);
+			while (!m_lists.compare_exchange_weak(t_list->next, t_list, std::memory_order_release, std::memory_order_relaxed));
+			t_id = m_id;
+		}
+		return t_list;
+	}
+
+	Batch* Claim(uint64_t epoch)
+	{
+		RetireList* list = ThreadList();
+		Batch* batch = list->open.exchange(nullptr, std::memory_order_acquire);
+		if (batch && batch->epoch != epoch)
+		{
+			Seal(batch);
+			batch = nullptr;
+		}
+		if (!batch)
+		{
+			batch = list->spare.exchange(nullptr, std::memory_order_acquire);
+			if (!batch)
+			{
+				batch = new Batch();
+				batch->owner = list;
+			}
+			batch->epoch = epoch;
+		}
+		return batch;
+	}
+
+	void Release(Batch* batch)
+	{
+		batch->owner->open.store(batch, std::memory_order_release);
+	}
+
+	void Seal(Batch* batch)
+	{
+		batch->next = m_sealed.load(std::memory_order_relaxed);
+		while (!m_sealed.compare_exchange_weak(batch->next, batch, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	//Moves sealed batches and every open batch not being filled right now to m_pending
+	void Gather()
+	{
+		Batch* batch = m_sealed.exchange(nullptr, std::memory_order_acquire);
+		while (batch)
+		{
+			Batch* next = batch->next;
+			m_pending.push_back(batch);
+			batch = next;
+		}
+		for (RetireList* list = m_lists.load(std::memory_order_acquire); list; list = list->next)
+		{
+			batch = list->open.exchange(nullptr, std::memory_order_acquire);
+			if (batch)
+				m_pending.push_back(batch);
+		}
+	}
+
+	void Recycle(Batch* batch)
+	{
+		batch->items.clear();
+		batch->next = nullptr;
+		Batch* empty = nullptr;
+		if (!batch->owner->spare.compare_exchange_strong(empty, batch, std::memory_order_release, std::memory_order_relaxed))
+			delete batch;
+	}
+
+	static void DeleteChain(Batch* batch)
+	{
+		while (batch)
+		{
+			Batch* next = batch->next;
+			delete batch;
+			batch = next;
+		}
+	}
+
+	static inline std::atomic<uint64_t> s_nextId = { 1 };
+	const uint64_t m_id;
+	std::atomic<RetireList*> m_lists = { nullptr };
+	std::atomic<Batch*> m_sealed = { nullptr };
+	std::vector<Batch*> m_pending = {};//Collector only
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <atomic>
+#include <cstring>
 
 #ifndef  POOL_END
 #define POOL_END 0xffff
@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+#define TRIPLE_BUFFER_SLOTS 3
+
+//Lock free handoff of whole frames from one producer to one consumer.
+//The producer fills the back slot and publishes it, the consumer reads the newest published slot.
+//Neither side waits, a frame published while the consumer is still reading the last one simply replaces the pending one.
+template <typename T>
+class TripleBuffer
+{
+public:
+	T& Slot(uint32_t index) { return m_slots[index]; }
+
+	//Producer side
+	uint32_t BackIndex() const { return m_back; }
+	T& Back() { return m_slots[m_back]; }
+	void Publish()
+	{
+		m_back = m_latest.exchange(m_back | FRESH, std::memory_order_acq_rel) & SLOT_MASK;
+	}
+
+	//Consumer side, returns the newest published slot and keeps it until a newer one exists
+	uint32_t Acquire()
+	{
+		if (m_latest.load(std::memory_order_acquire) & FRESH)
+			m_front = m_latest.exchange(m_front, std::memory_order_acq_rel) & SLOT_MASK;
+		return m_front;
+	}
+
+private:
+	static const uint32_t SLOT_MASK = 0x3;
+	static const uint32_t FRESH = 0x4;
+
+	T m_slots[TRIPLE_BUFFER_SLOTS] = {};
+	uint32_t m_back = 0;
+	std::atomic<uint32_t> m_latest = { 1 };
+	uint32_t m_front = 2;
+};
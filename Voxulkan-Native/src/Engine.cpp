@@ -1,11 +1,20 @@
 #include "Engine.h"
 #include "Plugin.h"
+#include "Containers/DistanceOrder.h"
 #include <algorithm>
+#include <cstring>
+#include <thread>
 
-Engine::Engine(IUnityGraphicsVulkan* unityVulkan)
+Engine::Engine(IUnityGraphicsVulkan* unityVulkan) : Engine(unityVulkan->Instance())
 {
 	m_unityVulkan = unityVulkan;
-	m_instance = m_unityVulkan->Instance();
+}
+
+//Used by hosts that own their device (headless builds), Draw is a no-op without Unity
+Engine::Engine(const UnityVulkanInstance& instance)
+{
+	m_instance = instance;
+	m_dumpFrame.store(0);
 
 	VmaAllocatorCreateInfo allocatorInfo = {};
 	allocatorInfo.physicalDevice = m_instance.physicalDevice;
@@ -61,6 +70,12 @@ void Engine::RegisterQueues(std::vector<VkQueue> queues, const uint32_t& queueFa
 		VK_CALL(vkCreateFence(m_instance.device, &fenceCI, nullptr, fences + i));
 	}
 
+	for (uint32_t i = 0; i < TRIPLE_BUFFER_SLOTS; i++)
+	{
+		m_renderFrames.Slot(i).clear();
+		m_renderFrames.Slot(i).resize(workerCount);
+	}
+
 	m_queues = new QueueResource[m_queueCount];
 	m_workers = new MPMCQueue<WorkerResource*>(workerCount);
 	uint8_t workerStart = 0;
@@ -80,6 +95,7 @@ void Engine::RegisterQueues(std::vector<VkQueue> queues, const uint32_t& queueFa
 		{
 			WorkerResource* wr = new WorkerResource();
 			wr->m_queueIndex = i;
+			wr->m_index = static_cast<uint8_t>(j);
 
 			VK_CALL(vkCreateCommandPool(m_instance.device, &computeCMDPoolInfo, nullptr, &wr->m_computeCMDPool));
 			workerCMDBInfo.commandPool = wr->m_computeCMDPool;
@@ -112,6 +128,12 @@ void Engine::SetComputeShaders(const std::vector<char>& surfaceAnalysis, const s
 	m_surfaceAssemblyPipeline.m_shader = surfaceAssembly;
 }
 
+void Engine::SetCullShaders(const std::vector<char>& chunkCull, const std::vector<char>& depthPyramid)
+{
+	m_chunkCullPipeline.m_shader = chunkCull;
+	m_depthPyramidPipeline.m_shader = depthPyramid;
+}
+
 void Engine::SetMaterialResources(void* attributesBuffer, uint32_t attribsByteCount,
 	void* colorSpecData, uint32_t csWidth, uint32_t csHeight,
 	void* nrmHeightData, uint32_t nhWidth, uint32_t nhHeight,
@@ -120,6 +142,7 @@ void Engine::SetMaterialResources(void* attributesBuffer, uint32_t attribsByteCo
 	m_surfaceAttributesBuffer.m_bufferUsage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 	m_surfaceAttributesBuffer.m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
 	m_surfaceAttributesBuffer.m_byteCount = attribsByteCount;
+	m_surfaceAttributesBuffer.m_category = MEMORY_CATEGORY_MATERIALS;
 	m_surfaceAttributesBuffer.Allocate(this);
 
 	m_surfaceColorSpecTex.m_size = { csWidth, csHeight, 1};
@@ -132,6 +155,7 @@ void Engine::SetMaterialResources(void* attributesBuffer, uint32_t attribsByteCo
 	m_surfaceColorSpecTex.m_type = VK_IMAGE_TYPE_2D;
 	m_surfaceColorSpecTex.m_viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
 	m_surfaceColorSpecTex.m_usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	m_surfaceColorSpecTex.m_category = MEMORY_CATEGORY_MATERIALS;
 
 	m_surfaceNrmHeightTex = m_surfaceColorSpecTex;
 	m_surfaceColorSpecTex.Allocate(this);
@@ -255,7 +279,15 @@ void Engine::InitializeResources()
 	m_loadingFrame.store(0);
 	InitializeRenderPipeline();
 	InitializeComputePipelines();
-	InitializeStagingResources(50); //TODO: Replace constant with variable
+	InitializeStagingResources(50);
+	if (!m_meshArena)
+		m_meshArena = new MeshArena(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	if (!m_scheduler)
+	{
+		//Bodies are traversed on the host's job workers, the pool only adds threads for the cores they and the main thread leave idle
+		uint32_t busy = 1U + m_jobWorkerCount;
+		m_scheduler = new TaskScheduler(GetWorkerCount() > busy ? GetWorkerCount() - busy : 0U);
+	}
 	
 	GarbageCollect(GC_FORCE_COMPLETE);
 }
@@ -263,6 +295,7 @@ void Engine::InitializeResources()
 void Engine::ReleaseResources()
 {
 	vkDeviceWaitIdle(m_instance.device);
+	SAFE_DEL(m_scheduler);
 	ReleaseStagingResources();
 	ReleaseRenderPipelines();
 	ReleaseComputePipelines();
@@ -284,13 +317,24 @@ void Engine::ReleaseResources()
 
 	delete m_workers;
 	delete[] fences;
+	for (uint32_t i = 0; i < TRIPLE_BUFFER_SLOTS; i++)
+		m_renderFrames.Slot(i).clear();
 	delete[] m_queues;
 
+	m_drawCommandRing.Release(this);
+	m_cullInputRing.Release(this);
+	m_cullOutputRing.Release(this);
 	m_surfaceAttributesBuffer.Release(this);
 	m_surfaceColorSpecTex.Release(this);
 	m_surfaceNrmHeightTex.Release(this);
 
 	GarbageCollect(GC_FORCE_COMPLETE);
+	m_resourceCache.Release(this);
+	if (m_meshArena)//Ranges return to the arena as they are collected
+	{
+		m_meshArena->Release(this);
+		SAFE_DEL(m_meshArena);
+	}
 	vmaDestroyAllocator(m_allocator);
 }
 
@@ -326,74 +370,471 @@ void Engine::SubmitQueue(uint8_t queueIndex)
 	}
 }
 
-#include <chrono>
-typedef std::chrono::high_resolution_clock Clock;
-
 void Engine::QueryOcclusion(Camera* camera)
 {
-	size_t sortDur = 0;
-
-	auto t1 = Clock::now();
+	//Traversal of the back frame is complete, every camera reads it in parallel and only writes its own packet
+	uint32_t slot = m_renderFrames.BackIndex();
+	const std::vector<BodyRenderList>& frame = m_renderFrames.Slot(slot);
+	CameraPacket& packet = camera->m_packets[slot];
+	packet.bodies.clear();
+	packet.chunks.clear();
 
-	std::vector<BodyRenderPackage> render = m_render.vector();
 	CameraView cameraConsts = const_cast<CameraView&>(camera->m_view);
-	size_t bI = 0;
+	std::vector<float>& distances = camera->m_orderDistances;
+	std::vector<uint32_t>& scratch = camera->m_orderScratch;
 
-	sortDur = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t1).count();
-	for (size_t i = 0; i < render.size(); i++)
-	{
-		BodyRenderPackage& r = render[i];
-		glm::mat4x4 mvp = cameraConsts.viewProjection * r.transform;
+	//Chunks are culled per frame on the GPU when Cull can run, only bodies are tested and ordered here
+	bool cullChunks = !GPUCulling();
 
-		if (ChunkRenderPackage::FrustumTest(mvp, r.min, r.max))
+	for (size_t w = 0; w < frame.size(); w++)
+	{
+		const BodyRenderList& list = frame[w];
+		for (size_t i = 0; i < list.count; i++)
 		{
-			glm::vec3 cPos = glm::inverse(const_cast<glm::mat4x4&>(r.transform)) * glm::vec4(cameraConsts.worldPosition, 1.0);
+			const BodyRenderPackage& r = list.bodies[i];
+			glm::mat4x4 mvp = cameraConsts.viewProjection * r.transform;
+			if (!ChunkRenderPackage::FrustumTest(mvp, r.min, r.max))
+				continue;
+
+			glm::vec3 cPos = glm::inverse(r.transform) * glm::vec4(cameraConsts.worldPosition, 1.0);
 			glm::vec3 delta = cPos - glm::clamp(cPos, r.min, r.max);
-			r.distance = delta.x * delta.x + delta.y * delta.y + delta.z * delta.z;
 
-			size_t cI = 0;
-			for (size_t j = 0; j < r.chunks.size(); j++)
+			BodyView view = {};
+			view.body = &r;
+			view.firstChunk = static_cast<uint32_t>(packet.chunks.size());
+			view.distance = delta.x * delta.x + delta.y * delta.y + delta.z * delta.z;
+			if (cullChunks)
 			{
-				ChunkRenderPackage& chunk = r.chunks[j];
-
-				if (ChunkRenderPackage::FrustumTest(mvp, chunk.min, chunk.max))
-				{
-					delta = cPos - glm::clamp(cPos, chunk.min, chunk.max);
-					chunk.distance = delta.x * delta.x + delta.y * delta.y + delta.z * delta.z;
-					if(cI != j) r.chunks[cI] = std::move(chunk);
-					cI++;
-				}
+				packet.chunks.resize(view.firstChunk + r.bounds.Size());
+				distances.resize(r.bounds.PaddedSize());
+				uint32_t* visible = packet.chunks.data() + view.firstChunk;
+				size_t cI = r.bounds.Cull(mvp, cPos, visible, distances.data());
+				SortByDistance(distances.data(), visible, cI, scratch);
+				packet.chunks.resize(view.firstChunk + cI);
 			}
+			else
+			{
+				for (size_t j = 0; j < r.chunks.size(); j++)
+					packet.chunks.push_back(static_cast<uint32_t>(j));
+			}
+			view.chunkCount = static_cast<uint32_t>(packet.chunks.size() - view.firstChunk);
+			if (view.chunkCount > 0)
+				packet.bodies.push_back(view);
+		}
+	}
 
-			r.chunks.resize(cI);
-			std::sort(r.chunks.begin(), r.chunks.end());
-
-			if(bI != i) render[bI] = std::move(r);
-			bI++;
+	size_t bodyCount = packet.bodies.size();
+	std::vector<uint32_t>& order = camera->m_orderIndices;
+	distances.resize(bodyCount);
+	order.resize(bodyCount);
+	for (size_t i = 0; i < bodyCount; i++)
+	{
+		distances[i] = packet.bodies[i].distance;
+		order[i] = static_cast<uint32_t>(i);
+	}
+	SortByDistance(distances.data(), order.data(), bodyCount, scratch);
+	std::vector<BodyView>& sorted = camera->m_orderBodies;
+	sorted.resize(bodyCount);
+	for (size_t i = 0; i < bodyCount; i++)
+		sorted[i] = packet.bodies[order[i]];
+	packet.bodies.swap(sorted);
+
+	//Draw records in final order, consecutive chunks of a body sharing mesh buffers form a run drawn by a single indirect draw
+	packet.runs.clear();
+	packet.commands.clear();
+	packet.records.clear();
+	for (uint32_t b = 0; b < static_cast<uint32_t>(bodyCount); b++)
+	{
+		const BodyView& view = packet.bodies[b];
+		for (uint32_t j = 0; j < view.chunkCount; j++)
+		{
+			const ChunkRenderPackage& crp = view.body->chunks[packet.chunks[view.firstChunk + j]];
+			uint32_t first = static_cast<uint32_t>(packet.commands.size());
+			if (packet.runs.empty() || packet.runs.back().body != b ||
+				packet.runs.back().vertexBuffer != crp.vertexBuffer->m_buffer || packet.runs.back().indexBuffer != crp.indexBuffer->m_buffer ||
+				packet.runs.back().indexType != crp.indexType)
+				packet.runs.push_back({ b, crp.vertexBuffer->m_buffer, crp.indexBuffer->m_buffer, crp.indexType, first, 0 });
+			DrawRun& run = packet.runs.back();
+			run.count++;
+
+			VkDrawIndexedIndirectCommand command = {};
+			command.indexCount = crp.indexCount;
+			command.instanceCount = 1;
+			command.firstIndex = (uint32_t)(crp.indexBuffer->m_offset / (crp.indexType == VK_INDEX_TYPE_UINT16 ? 2 : INDEX_BYTE_SIZE));
+			command.vertexOffset = (int32_t)(crp.vertexBuffer->m_offset / VERTEX_BYTE_SIZE + VERTEX_HEADER_COUNT);
+			command.firstInstance = (uint32_t)(crp.vertexBuffer->m_offset / VERTEX_BYTE_SIZE);//Selects the chunk header on the per instance binding
+			packet.commands.push_back(command);
+
+			if (!cullChunks)
+			{
+				ChunkCullRecord record = {};
+				record.min = crp.min;
+				record.max = crp.max;
+				record.body = b;
+				record.run = static_cast<uint32_t>(packet.runs.size() - 1);
+				record.indexCount = command.indexCount;
+				record.firstIndex = command.firstIndex;
+				record.vertexOffset = command.vertexOffset;
+				record.runFirst = run.first;
+				packet.records.push_back(record);
+			}
 		}
 	}
+}
 
-	render.resize(bI);
-	std::sort(render.begin(), render.end());
+void Engine::ClearRender()
+{
+	//Hands the finished frame to the render thread and starts the next one in a slot it is not reading
+	m_renderFrames.Publish();
+	std::vector<BodyRenderList>& frame = m_renderFrames.Back();
+	for (size_t i = 0; i < frame.size(); i++)
+		frame[i].count = 0;
+	ScheduleBuilds();//Every body finished traversing by now
+}
 
-	LOG("Sort: " + std::to_string(sortDur));
+void Engine::ScheduleBuilds()
+{
+	m_memoryGovernor.Update(m_instance.physicalDevice, m_loadingFrame.load());
+	if (m_stagingPool)
+	{
+		m_buildQueue.Grant(m_stagingPool, m_buildBudget);
+		m_stagingPool->Update(this, m_buildQueue.Backlog(), m_buildQueue.Starved());
+	}
+}
 
-	camera->m_renderPackage.swap(render);
+void Engine::SetStagingBudget(uint64_t byteBudget)
+{
+	if (m_stagingPool)
+		m_stagingPool->SetByteBudget(byteBudget);
 }
 
-void Engine::ClearRender()
+StagingPoolStats Engine::GetStagingStats()
+{
+	return m_stagingPool ? m_stagingPool->GetStats() : StagingPoolStats();
+}
+
+MeshArenaStats Engine::GetMeshArenaStats()
+{
+	return m_meshArena ? m_meshArena->GetStats() : MeshArenaStats();
+}
+
+ResourceCacheStats Engine::GetResourceCacheStats()
+{
+	return m_resourceCache.GetStats();
+}
+
+MemoryStats Engine::GetMemoryStats()
+{
+	return m_memoryGovernor.GetStats();
+}
+
+bool Engine::GPUCulling()
+{
+	VkPipeline pipeline;
+	VkPipelineLayout layout;
+	m_chunkCullPipeline.GetVkPipeline(pipeline, layout);
+	return m_unityVulkan != nullptr && pipeline != VK_NULL_HANDLE && m_indirectFirstInstance;
+}
+
+void Engine::Cull(Camera* camera)
+{
+	VkPipeline pipeline;
+	VkPipelineLayout layout;
+	m_chunkCullPipeline.GetVkPipeline(pipeline, layout);
+	UnityVulkanRecordingState recordingState;
+	if (!GPUCulling() || !m_unityVulkan->CommandRecordingState(&recordingState, kUnityVulkanGraphicsQueueAccess_DontCare))
+		return;
+
+	AdvanceFrame(recordingState.currentFrameNumber, recordingState.safeFrameNumber);
+	VkCommandBuffer cmdb = recordingState.commandBuffer;
+	CameraView cameraConsts = const_cast<CameraView&>(camera->m_view);
+
+	//Records were built by the occlusion query, only the body matrices depend on the view
+	const CameraPacket& packet = camera->m_packets[m_renderFrames.Acquire()];
+	if (packet.records.size() != packet.commands.size())
+		return;//Queried before the cull pipeline existed, drawn unculled
+
+	camera->m_culledRuns.assign(packet.runs.begin(), packet.runs.end());
+	camera->m_culledTransforms.clear();
+	m_cullBodies.clear();
+	for (size_t i = 0; i < packet.bodies.size(); i++)
+	{
+		const glm::mat4x4& transform = packet.bodies[i].body->transform;
+		camera->m_culledTransforms.push_back(transform);
+		m_cullBodies.push_back(cameraConsts.viewProjection * transform);
+	}
+
+	uint32_t chunkCount = static_cast<uint32_t>(packet.records.size());
+	if (chunkCount == 0)
+	{
+		camera->m_culledFrame = recordingState.currentFrameNumber;
+		camera->m_culledRuns.clear();
+		return;
+	}
+
+	//Records and body matrices share one reservation, as do the commands and run counts written by the shader
+	VkDeviceSize recordBytes = chunkCount * sizeof(ChunkCullRecord);
+	VkDeviceSize bodyStart = (recordBytes + FRAME_RING_ALIGNMENT - 1) & ~(FRAME_RING_ALIGNMENT - 1);
+	VkDeviceSize bodyBytes = m_cullBodies.size() * sizeof(glm::mat4x4);
+	VkBuffer inputBuffer = VK_NULL_HANDLE;
+	VkDeviceSize inputOffset = 0;
+	if (!m_cullInputRing.Reserve(this, recordingState.currentFrameNumber, recordingState.safeFrameNumber, bodyStart + bodyBytes, inputBuffer, inputOffset))
+		return;
+	m_cullInputRing.Upload(this, inputOffset, packet.records.data(), recordBytes);
+	m_cullInputRing.Upload(this, inputOffset + bodyStart, m_cullBodies.data(), bodyBytes);
+
+	const bool compact = vkCmdDrawIndexedIndirectCountFn != nullptr;
+	VkDeviceSize commandBytes = chunkCount * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize countStart = (commandBytes + FRAME_RING_ALIGNMENT - 1) & ~(FRAME_RING_ALIGNMENT - 1);
+	VkDeviceSize countBytes = camera->m_culledRuns.size() * sizeof(uint32_t);
+	VkBuffer outputBuffer = VK_NULL_HANDLE;
+	VkDeviceSize outputOffset = 0;
+	if (!m_cullOutputRing.Reserve(this, recordingState.currentFrameNumber, recordingState.safeFrameNumber, countStart + countBytes, outputBuffer, outputOffset))
+		return;
+	camera->m_culledFrame = recordingState.currentFrameNumber;
+	camera->m_culledCommands = outputBuffer;
+	camera->m_culledCommandOffset = outputOffset;
+	camera->m_culledCountOffset = outputOffset + countStart;
+
+	VkMemoryBarrier memB = {};
+	memB.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	if (compact)
+	{
+		vkCmdFillBuffer(cmdb, outputBuffer, camera->m_culledCountOffset, countBytes, 0);
+		memB.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memB.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(cmdb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			1, &memB,
+			0, nullptr,
+			0, nullptr);
+	}
+
+	uint32_t levelCount = BuildDepthPyramid(camera, cmdb);
+
+	ChunkCullConstants ccc = {};
+	ccc.chunkCount = chunkCount;
+	ccc.compact = compact ? 1 : 0;
+	ccc.levelCount = levelCount;
+	ccc.pyramidSize = camera->m_pyramidSize;
+
+	VkDescriptorBufferInfo recordInfo = { inputBuffer, inputOffset, recordBytes };
+	VkDescriptorBufferInfo bodyInfo = { inputBuffer, inputOffset + bodyStart, bodyBytes };
+	VkDescriptorImageInfo pyramidInfo = { VK_NULL_HANDLE, camera->m_depthPyramid.m_gpuHandle->m_view, VK_IMAGE_LAYOUT_GENERAL };
+	VkDescriptorBufferInfo commandInfo = { outputBuffer, outputOffset, commandBytes };
+	VkDescriptorBufferInfo countInfo = { outputBuffer, camera->m_culledCountOffset, countBytes };
+
+	std::vector<VkWriteDescriptorSet> writes(5);
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writes[0].dstBinding = 0;
+	writes[0].pBufferInfo = &recordInfo;
+	writes[1] = writes[0];
+	writes[1].dstBinding = 1;
+	writes[1].pBufferInfo = &bodyInfo;
+	writes[2] = writes[0];
+	writes[2].dstBinding = 2;
+	writes[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[2].pBufferInfo = nullptr;
+	writes[2].pImageInfo = &pyramidInfo;
+	writes[3] = writes[0];
+	writes[3].dstBinding = 3;
+	writes[3].pBufferInfo = &commandInfo;
+	writes[4] = writes[0];
+	writes[4].dstBinding = 4;
+	writes[4].pBufferInfo = &countInfo;
+
+	vkCmdBindPipeline(cmdb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdPushDescriptorSet(cmdb, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, static_cast<uint32_t>(writes.size()), writes.data());
+	vkCmdPushConstants(cmdb, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ChunkCullConstants), &ccc);
+	vkCmdDispatch(cmdb, (chunkCount + 63) / 64, 1, 1);
+
+	memB.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memB.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	vkCmdPipelineBarrier(cmdb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		0,
+		1, &memB,
+		0, nullptr,
+		0, nullptr);
+}
+
+uint32_t Engine::BuildDepthPyramid(Camera* camera, VkCommandBuffer commandBuffer)
+{
+	VkPipeline pipeline;
+	VkPipelineLayout layout;
+	m_depthPyramidPipeline.GetVkPipeline(pipeline, layout);
+
+	UnityVulkanImage source = {};
+	bool hasSource = false;
+	if (camera->m_depthSource && pipeline != VK_NULL_HANDLE)
+	{
+		VkImageSubresource subresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
+		hasSource = m_unityVulkan->AccessTexture(camera->m_depthSource, &subresource, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, kUnityVulkanResourceAccess_PipelineBarrier, &source);
+	}
+
+	//Without a depth source a single texel stands in so the cull shader always has an image bound
+	glm::uvec2 size = hasSource ? glm::uvec2((source.extent.width + 1) / 2, (source.extent.height + 1) / 2) : glm::uvec2(1, 1);
+	uint32_t levelCount = hasSource ? 1 : 0;
+	glm::uvec2 atlas = size;
+	uint32_t column = 0;
+	for (glm::uvec2 level = size; hasSource && (level.x > 1 || level.y > 1); levelCount++)
+	{
+		level = glm::max((level + 1U) / 2U, glm::uvec2(1));
+		atlas.x = size.x + ((size.x + 1) / 2);
+		column += level.y;
+	}
+	atlas.y = std::max(atlas.y, column);
+
+	if (!camera->m_depthPyramid.m_gpuHandle || camera->m_pyramidSize != size || camera->m_pyramidLevels != levelCount)
+	{
+		camera->m_depthPyramid.Release(this);
+		camera->m_depthPyramid.m_size = { atlas.x, atlas.y, 1 };
+		camera->m_depthPyramid.m_format = VK_FORMAT_R32_SFLOAT;
+		camera->m_depthPyramid.m_usage = VK_IMAGE_USAGE_STORAGE_BIT;
+		camera->m_depthPyramid.m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
+		camera->m_depthPyramid.Allocate(this);
+		camera->m_pyramidSize = size;
+		camera->m_pyramidLevels = levelCount;
+	}
+
+	//Every level is rewritten, the previous contents are discarded once last frame's cull is done reading them
+	VkImageMemoryBarrier imgB = {};
+	imgB.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imgB.image = camera->m_depthPyramid.m_gpuHandle->m_image;
+	imgB.srcAccessMask = 0;
+	imgB.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	imgB.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imgB.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	imgB.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imgB.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imgB.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &imgB);
+
+	if (!hasSource)
+		return 0;
+
+	if (source.image != camera->m_depthSourceImage)
+	{
+		//Only the view belongs to us, the handle never owns the image
+		DestroyResource(camera->m_depthSourceView);
+		camera->m_depthSourceView = new GPUImageHandle();
+		camera->m_depthSourceImage = source.image;
+
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = source.image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = source.format;
+		viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		VK_CALL(vkCreateImageView(m_instance.device, &viewInfo, nullptr, &camera->m_depthSourceView->m_view));
+	}
+
+	VkDescriptorImageInfo sourceInfo = { m_pointSampler, camera->m_depthSourceView->m_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	VkDescriptorImageInfo pyramidInfo = { VK_NULL_HANDLE, camera->m_depthPyramid.m_gpuHandle->m_view, VK_IMAGE_LAYOUT_GENERAL };
+	std::vector<VkWriteDescriptorSet> writes(2);
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[0].dstBinding = 0;
+	writes[0].pImageInfo = &sourceInfo;
+	writes[1] = writes[0];
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[1].dstBinding = 1;
+	writes[1].pImageInfo = &pyramidInfo;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdPushDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, static_cast<uint32_t>(writes.size()), writes.data());
+
+	VkMemoryBarrier memB = {};
+	memB.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memB.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memB.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	//Level 0 on the left, every smaller level stacked in a column to its right
+	DepthPyramidConstants dpc = {};
+	dpc.srcSize = glm::ivec2(source.extent.width, source.extent.height);
+	dpc.dstSize = glm::ivec2(size);
+	dpc.fromSource = 1;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthPyramidConstants), &dpc);
+		vkCmdDispatch(commandBuffer, (dpc.dstSize.x + 7) / 8, (dpc.dstSize.y + 7) / 8, 1);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			1, &memB,
+			0, nullptr,
+			0, nullptr);
+
+		dpc.srcOffset = dpc.dstOffset;
+		dpc.srcSize = dpc.dstSize;
+		dpc.fromSource = 0;
+		dpc.dstOffset = level == 0 ? glm::ivec2(size.x, 0) : dpc.dstOffset + glm::ivec2(0, dpc.dstSize.y);
+		dpc.dstSize = glm::max((dpc.dstSize + 1) / 2, glm::ivec2(1));
+	}
+	return levelCount;
+}
+
+void Engine::DrawCulled(Camera* camera, VkCommandBuffer commandBuffer, VkPipelineLayout layout)
 {
-	m_render.clear();
+	CameraView cameraConsts = const_cast<CameraView&>(camera->m_view);
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	const VkDeviceSize zeroOffsets[2] = { 0, 0 };
+	VkBuffer boundVertices = VK_NULL_HANDLE;
+	VkBuffer boundIndices = VK_NULL_HANDLE;
+	VkIndexType boundIndexType = VK_INDEX_TYPE_UINT32;
+	uint32_t boundBody = ~0U;
+	for (size_t i = 0; i < camera->m_culledRuns.size(); i++)
+	{
+		const DrawRun& run = camera->m_culledRuns[i];
+		if (run.body != boundBody)
+		{
+			boundBody = run.body;
+			ChunkPipelineConstants cpc = {};
+			cpc.model = camera->m_culledTransforms[run.body];
+			cpc.mvp = cameraConsts.viewProjection * cpc.model;
+			cpc.tessellationFactor = cameraConsts.tessellationFactor;
+			cpc.worldPosition = cameraConsts.worldPosition;
+			vkCmdPushConstants(commandBuffer, layout, RENDER_CONST_STAGE_BIT,
+				0, sizeof(ChunkPipelineConstants), &cpc);
+		}
+		if (run.vertexBuffer != boundVertices || run.indexBuffer != boundIndices || run.indexType != boundIndexType)
+		{
+			boundVertices = run.vertexBuffer;
+			boundIndices = run.indexBuffer;
+			boundIndexType = run.indexType;
+			VkBuffer vertexBindings[2] = { boundVertices, boundVertices };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBindings, zeroOffsets);
+			vkCmdBindIndexBuffer(commandBuffer, boundIndices, 0, boundIndexType);
+		}
+
+		//Compacted runs hold their survivors at the front, otherwise culled draws are left in place with no instances
+		VkDeviceSize offset = camera->m_culledCommandOffset + (VkDeviceSize)run.first * stride;
+		if (vkCmdDrawIndexedIndirectCountFn)
+			vkCmdDrawIndexedIndirectCountFn(commandBuffer, camera->m_culledCommands, offset,
+				camera->m_culledCommands, camera->m_culledCountOffset + i * sizeof(uint32_t), run.count, stride);
+		else if (m_multiDrawIndirect)
+			vkCmdDrawIndexedIndirect(commandBuffer, camera->m_culledCommands, offset, run.count, stride);
+		else
+		{
+			for (uint32_t k = 0; k < run.count; k++)
+				vkCmdDrawIndexedIndirect(commandBuffer, camera->m_culledCommands, offset + (VkDeviceSize)k * stride, 1, stride);
+		}
+	}
 }
 
 void Engine::Draw(Camera* camera)
 {
 	UnityVulkanRecordingState recordingState;
-	if (!m_unityVulkan->CommandRecordingState(&recordingState, kUnityVulkanGraphicsQueueAccess_DontCare))
+	if (m_unityVulkan == nullptr || !m_unityVulkan->CommandRecordingState(&recordingState, kUnityVulkanGraphicsQueueAccess_DontCare))
 		return;
 
-	m_loadingFrame.store(recordingState.currentFrameNumber);
-	m_dumpFrame.store(recordingState.safeFrameNumber - SAFE_DUMP_MARGIN);
+	AdvanceFrame(recordingState.currentFrameNumber, recordingState.safeFrameNumber);
 	
 	VkPipeline pipeline;
 	VkPipelineLayout layout;
@@ -401,41 +842,74 @@ void Engine::Draw(Camera* camera)
 	m_renderPipeline.GetVkPipeline(pipeline, layout);
 	
 	CameraView cameraConsts = const_cast<CameraView&>(camera->m_view);
-	const VkDeviceSize offset = 0;
 	vkCmdBindPipeline(recordingState.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 	vkCmdBindDescriptorSets(recordingState.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &m_renderDSet, 0, nullptr);
 
-	//auto t1 = Clock::now();
-	camera->m_renderPackage.lock();
-	for (size_t i = 0; i < camera->m_renderPackage.size(); i++)
+	if (camera->m_culledFrame == recordingState.currentFrameNumber)
 	{
-		BodyRenderPackage& brp = camera->m_renderPackage[i];
+		DrawCulled(camera, recordingState.commandBuffer, layout);
+		return;
+	}
 
-		ChunkPipelineConstants cpc = {};
-		cpc.model = const_cast<glm::mat4x4&>(brp.transform);
-		cpc.mvp = cameraConsts.viewProjection * cpc.model;
-		cpc.tessellationFactor = cameraConsts.tessellationFactor;
-		cpc.worldPosition = cameraConsts.worldPosition;
+	//Commands and runs were built by the occlusion query, recording costs a copy and one draw per run whatever the chunk count
+	const CameraPacket& packet = camera->m_packets[m_renderFrames.Acquire()];
+	uint32_t chunkCount = static_cast<uint32_t>(packet.commands.size());
+	if (chunkCount == 0)
+		return;
 
-		vkCmdPushConstants(recordingState.commandBuffer, layout, RENDER_CONST_STAGE_BIT,
-			0, sizeof(ChunkPipelineConstants), &cpc);
+	VkBuffer drawBuffer = VK_NULL_HANDLE;
+	VkDeviceSize commandOffset = 0;
+	if (!m_drawCommandRing.Reserve(this, recordingState.currentFrameNumber, recordingState.safeFrameNumber, chunkCount * sizeof(VkDrawIndexedIndirectCommand), drawBuffer, commandOffset))
+		return;//Out of memory, the frame goes without chunks
+	m_drawCommandRing.Upload(this, commandOffset, packet.commands.data(), chunkCount * sizeof(VkDrawIndexedIndirectCommand));
+
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	const VkDeviceSize zeroOffsets[2] = { 0, 0 };
+	VkBuffer boundVertices = VK_NULL_HANDLE;
+	VkBuffer boundIndices = VK_NULL_HANDLE;
+	VkIndexType boundIndexType = VK_INDEX_TYPE_UINT32;
+	uint32_t boundBody = ~0U;
+	for (size_t i = 0; i < packet.runs.size(); i++)
+	{
+		const DrawRun& run = packet.runs[i];
+		if (run.body != boundBody)
+		{
+			boundBody = run.body;
+			ChunkPipelineConstants cpc = {};
+			cpc.model = packet.bodies[run.body].body->transform;
+			cpc.mvp = cameraConsts.viewProjection * cpc.model;
+			cpc.tessellationFactor = cameraConsts.tessellationFactor;
+			cpc.worldPosition = cameraConsts.worldPosition;
+			vkCmdPushConstants(recordingState.commandBuffer, layout, RENDER_CONST_STAGE_BIT,
+				0, sizeof(ChunkPipelineConstants), &cpc);
+		}
+		if (run.vertexBuffer != boundVertices || run.indexBuffer != boundIndices || run.indexType != boundIndexType)
+		{
+			boundVertices = run.vertexBuffer;
+			boundIndices = run.indexBuffer;
+			boundIndexType = run.indexType;
+			VkBuffer vertexBindings[2] = { boundVertices, boundVertices };
+			vkCmdBindVertexBuffers(recordingState.commandBuffer, 0, 2, vertexBindings, zeroOffsets);
+			vkCmdBindIndexBuffer(recordingState.commandBuffer, boundIndices, 0, boundIndexType);
+		}
 
-		for (size_t j = 0; j < brp.chunks.size(); j++)
+		VkDeviceSize offset = commandOffset + (VkDeviceSize)run.first * stride;
+		if (!m_indirectFirstInstance)
+		{
+			for (uint32_t k = run.first; k < run.first + run.count; k++)
+			{
+				const VkDrawIndexedIndirectCommand& command = packet.commands[k];
+				vkCmdDrawIndexed(recordingState.commandBuffer, command.indexCount, 1, command.firstIndex, command.vertexOffset, command.firstInstance);
+			}
+		}
+		else if (m_multiDrawIndirect)
+			vkCmdDrawIndexedIndirect(recordingState.commandBuffer, drawBuffer, offset, run.count, stride);
+		else
 		{
-			ChunkRenderPackage crp = brp.chunks[j];
-			vkCmdBindVertexBuffers(recordingState.commandBuffer, 0, 1, &crp.vertexBuffer->m_buffer, &offset);
-			vkCmdBindIndexBuffer(recordingState.commandBuffer, crp.indexBuffer->m_buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(recordingState.commandBuffer, crp.indexCount, 1, 0, 0, 0);
+			for (uint32_t k = 0; k < run.count; k++)
+				vkCmdDrawIndexedIndirect(recordingState.commandBuffer, drawBuffer, offset + (VkDeviceSize)k * stride, 1, stride);
 		}
 	}
-	camera->m_renderPackage.unlock();
-	/*
-	auto t2 = Clock::now();
-	std::stringstream ss;
-	ss << "Delta t2-t1: "
-		<< std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count()
-		<< " nanoseconds" << std::endl;
-	LOG(ss.str());*/
 }
 
 ComputePipeline* Engine::CreateFormPipeline(const std::vector<char>& shader)
@@ -455,12 +929,12 @@ ComputePipeline* Engine::CreateFormPipeline(const std::vector<char>& shader)
 void Engine::DestroyResource(GPUResourceHandle* resource)
 {
 	if (resource)
-		m_loadingGarbage.add(resource);
+		m_garbage.Retire(resource, m_loadingFrame.load(std::memory_order_relaxed));
 }
 
 void Engine::DestroyResources(const std::vector<GPUResourceHandle*>& resources)
 {
-	m_loadingGarbage.add(resources);
+	m_garbage.Retire(resources, m_loadingFrame.load(std::memory_order_relaxed));
 }
 
 uint8_t Engine::GetWorkerCount()
@@ -508,24 +982,28 @@ void Engine::InitializeRenderPipeline()
 	m_renderPipeline.m_descriptorSetLayouts = dSetLayouts;
 
 
-	std::vector<VkVertexInputBindingDescription> vertexBindings(1);
+	//Packed vertices, and the header of the drawn chunk read once per instance from the same buffer
+	std::vector<VkVertexInputBindingDescription> vertexBindings(2);
 	vertexBindings[0].binding = 0;
-	vertexBindings[0].stride = 16;
+	vertexBindings[0].stride = VERTEX_BYTE_SIZE;
 	vertexBindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	vertexBindings[1].binding = 1;
+	vertexBindings[1].stride = VERTEX_BYTE_SIZE;
+	vertexBindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
 	std::vector<VkVertexInputAttributeDescription> vertexAttributes(3);
 	vertexAttributes[0].binding = 0;
 	vertexAttributes[0].location = 0;
-	vertexAttributes[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	vertexAttributes[0].format = VK_FORMAT_R32G32_UINT;
 	vertexAttributes[0].offset = 0;
-	vertexAttributes[1].binding = 0;
+	vertexAttributes[1].binding = 1;
 	vertexAttributes[1].location = 1;
-	vertexAttributes[1].format = VK_FORMAT_R8G8B8_UNORM;
-	vertexAttributes[1].offset = 12;
-	vertexAttributes[2].binding = 0;
+	vertexAttributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+	vertexAttributes[1].offset = 0;
+	vertexAttributes[2].binding = 1;
 	vertexAttributes[2].location = 2;
-	vertexAttributes[2].format = VK_FORMAT_R8_UINT;
-	vertexAttributes[2].offset = 15;
+	vertexAttributes[2].format = VK_FORMAT_R32G32B32_SFLOAT;
+	vertexAttributes[2].offset = 12;
 	m_renderPipeline.m_vertexBindings = vertexBindings;
 	m_renderPipeline.m_vertexAttributes = vertexAttributes;
 }
@@ -619,34 +1097,90 @@ void Engine::InitializeComputePipelines()
 	surfacePushConsts[0].size = sizeof(SurfaceAssemblyConstants);
 	m_surfaceAssemblyPipeline.m_pushConstants = surfacePushConsts;
 	m_surfaceAssemblyPipeline.Allocate(this);
+
+	//GPU culling is optional, chunks are culled on the CPU without its shaders
+	if (m_chunkCullPipeline.m_shader.empty() || m_depthPyramidPipeline.m_shader.empty())
+		return;
+
+	//Chunk records
+	//Body matrices
+	//Depth pyramid
+	//Draw commands
+	//Run counts
+	std::vector<VkDescriptorSetLayoutBinding> cullBindings(5);
+	for (uint32_t i = 0; i < cullBindings.size(); i++)
+	{
+		cullBindings[i].binding = i;
+		cullBindings[i].pImmutableSamplers = 0;
+		cullBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		cullBindings[i].descriptorCount = 1;
+		cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	cullBindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+	layoutCI.bindingCount = static_cast<uint32_t>(cullBindings.size());
+	layoutCI.pBindings = cullBindings.data();
+	m_chunkCullPipeline.m_descriptorSetLayouts = std::vector<VkDescriptorSetLayout>(1);
+	VK_CALL(vkCreateDescriptorSetLayout(m_instance.device,
+		&layoutCI,
+		nullptr,
+		m_chunkCullPipeline.m_descriptorSetLayouts.data()));
+
+	surfacePushConsts[0].size = sizeof(ChunkCullConstants);
+	m_chunkCullPipeline.m_pushConstants = surfacePushConsts;
+	m_chunkCullPipeline.Allocate(this);
+
+	//Depth source
+	//Pyramid
+	cullBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	cullBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	layoutCI.bindingCount = 2;
+	m_depthPyramidPipeline.m_descriptorSetLayouts = std::vector<VkDescriptorSetLayout>(1);
+	VK_CALL(vkCreateDescriptorSetLayout(m_instance.device,
+		&layoutCI,
+		nullptr,
+		m_depthPyramidPipeline.m_descriptorSetLayouts.data()));
+
+	surfacePushConsts[0].size = sizeof(DepthPyramidConstants);
+	m_depthPyramidPipeline.m_pushConstants = surfacePushConsts;
+	m_depthPyramidPipeline.Allocate(this);
+
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	VK_CALL(vkCreateSampler(m_instance.device, &samplerInfo, nullptr, &m_pointSampler));
 }
 
-void Engine::InitializeStagingResources(uint8_t poolSize)
+void Engine::InitializeStagingResources(uint32_t minCount)
 {
 	ReleaseStagingResources();
 	VkDescriptorPoolCreateInfo descPoolCI = {};
 	descPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	descPoolCI.maxSets = (uint32_t)poolSize * 3 + 1;
+	descPoolCI.maxSets = 1;
 	descPoolCI.flags = 0;
 
-	std::vector<VkDescriptorPoolSize> DPSizes(4);
-	DPSizes[0].descriptorCount = poolSize * 5;
-	DPSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-	DPSizes[1].descriptorCount = poolSize * 4;
-	DPSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	//Rendering descriptor
-	DPSizes[2].descriptorCount = 1;
-	DPSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	DPSizes[3].descriptorCount = 2;
-	DPSizes[3].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	//Staging descriptor sets live in ChunkStagingPool
+	std::vector<VkDescriptorPoolSize> DPSizes(2);
+	DPSizes[0].descriptorCount = 1;
+	DPSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	DPSizes[1].descriptorCount = 2;
+	DPSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 
 	descPoolCI.poolSizeCount = static_cast<uint32_t>(DPSizes.size());
 	descPoolCI.pPoolSizes = DPSizes.data();
-	vkCreateDescriptorPool(m_instance.device, &descPoolCI, nullptr, &m_stagingDescriptorPool);
+	vkCreateDescriptorPool(m_instance.device, &descPoolCI, nullptr, &m_renderDescriptorPool);
 
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = m_stagingDescriptorPool;
+	allocInfo.descriptorPool = m_renderDescriptorPool;
 	allocInfo.descriptorSetCount = 1;
 	allocInfo.pSetLayouts = &m_renderPipeline.m_descriptorSetLayouts[0];
 	VK_CALL(vkAllocateDescriptorSets(m_instance.device, &allocInfo, &m_renderDSet));
@@ -678,55 +1212,18 @@ void Engine::InitializeStagingResources(uint8_t poolSize)
 
 	vkUpdateDescriptorSets(m_instance.device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 
-	WorkerResource* wr;
-	m_workers->pop(wr);
-
-	VkCommandBuffer cmdB = wr->m_computeCMDBs[0];
-	VkCommandBufferBeginInfo beginI = {};
-	beginI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginI.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	VK_CALL(vkBeginCommandBuffer(cmdB, &beginI));
-
-	std::vector<VkImageMemoryBarrier> imageBarriers((uint64_t)poolSize * 2);
-
-	std::vector<VkDescriptorSetLayout> layouts(3);
-	layouts[0] = m_formDSetLayout;
-	layouts[1] = m_surfaceAnalysisPipeline.m_descriptorSetLayouts[0];
-	layouts[2] = m_surfaceAssemblyPipeline.m_descriptorSetLayouts[0];
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
-	allocInfo.pSetLayouts = layouts.data();
-
-	std::vector<VkDescriptorSet> sets(3);
-	m_stagingResources = new MPMCQueue<ChunkStagingResources*>(poolSize);
-	for (uint32_t i = 0; i < m_stagingResources->capacity(); i++)
+	//VMA 2.2 has no budget query, keep staging within a slice of the largest device local heap
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(m_instance.physicalDevice, &memoryProperties);
+	VkDeviceSize deviceLocal = 0;
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
 	{
-		ChunkStagingResources* sRes = new ChunkStagingResources(this, CHUNK_SIZE, CHUNK_PADDING);
-
-		VK_CALL(vkAllocateDescriptorSets(m_instance.device, &allocInfo, sets.data()));
-		sRes->WriteDescriptors(this, sets[0], sets[1], sets[2]);
-		sRes->GetImageTransferBarriers(imageBarriers[i], imageBarriers[i + (uint64_t)poolSize]);
-
-		m_stagingResources->push(sRes);
+		if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			deviceLocal = std::max(deviceLocal, memoryProperties.memoryHeaps[i].size);
 	}
 
-	vkCmdPipelineBarrier(cmdB,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-		0,
-		0, nullptr,
-		0, nullptr,
-		static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
-
-	VK_CALL(vkEndCommandBuffer(cmdB));
-
-	VkQueue queue = m_queues[0].m_queue;
-	VkSubmitInfo subInfo = {};
-	subInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	subInfo.commandBufferCount = 1;
-	subInfo.pCommandBuffers = &cmdB;
-	VK_CALL(vkQueueSubmit(queue, 1, &subInfo, nullptr));
-	VK_CALL(vkQueueWaitIdle(queue));
-
-	m_workers->push(wr);
+	m_stagingPool = new ChunkStagingPool(minCount, deviceLocal / 32);
+	m_stagingPool->Update(this, 0, 0);
 }
 
 void Engine::ReleaseRenderPipelines()
@@ -741,6 +1238,15 @@ void Engine::ReleaseComputePipelines()
 	m_surfaceAssemblyPipeline.Release(this);
 	//m_surfaceAnalysisPipeline.DestroyDSetLayouts(this);//Assembly shares analysis Layouts and more, therefor only assembly should be destroyed
 	m_surfaceAssemblyPipeline.DestroyDSetLayouts(this);
+	m_chunkCullPipeline.Release(this);
+	m_chunkCullPipeline.DestroyDSetLayouts(this);
+	m_chunkCullPipeline.m_descriptorSetLayouts.clear();
+	m_depthPyramidPipeline.Release(this);
+	m_depthPyramidPipeline.DestroyDSetLayouts(this);
+	m_depthPyramidPipeline.m_descriptorSetLayouts.clear();
+	if (m_pointSampler)
+		vkDestroySampler(m_instance.device, m_pointSampler, nullptr);
+	m_pointSampler = VK_NULL_HANDLE;
 	if (m_surfaceAnalysisPipeline.m_descriptorSetLayouts.size() != 0)
 	if (m_formDSetLayout)
 		vkDestroyDescriptorSetLayout(m_instance.device, m_formDSetLayout, nullptr);
@@ -748,53 +1254,63 @@ void Engine::ReleaseComputePipelines()
 
 void Engine::ReleaseStagingResources()
 {
-	if (m_stagingResources == nullptr)
+	if (m_stagingPool == nullptr)
 		return;
 
-	std::vector<GPUResourceHandle*> resources;
-
-	ChunkStagingResources* handle;
-	while (m_stagingResources->try_pop(handle)) { resources.push_back(handle); }
-
-	DestroyResources(resources);
+	m_stagingPool->Release(this);
+	SAFE_DEL(m_stagingPool);
 
-	vkDestroyDescriptorPool(m_instance.device, m_stagingDescriptorPool, nullptr);
-	SAFE_DEL(m_stagingResources);
+	vkDestroyDescriptorPool(m_instance.device, m_renderDescriptorPool, nullptr);
+	m_renderDescriptorPool = nullptr;
 }
 
 void Engine::GarbageCollect(const GCForce force)
 {
-	if (force >= GC_FORCE_UNSAFE || m_dumpingFrame <= m_dumpFrame.load())
+	uint32_t retIndex = 0;
+	for (uint32_t i = 0; i < m_pinnedGarbage.size(); i++)
 	{
-		uint32_t retIndex = 0;
-		for (uint32_t i = 0;i < m_dumpingGarbage.size();i++)
+		GPUResourceHandle* res = m_pinnedGarbage[i];
+		if (force >= GC_FORCE_PINNED || !res->IsPinned())
+			Reclaim(res, force);
+		else
 		{
-			GPUResourceHandle* res = m_dumpingGarbage[i];
-			if (force >= GC_FORCE_PINNED || !res->IsPinned())
-			{
-				res->Deallocate(this);
-				delete res;
-			}
-			else
-			{
-				m_dumpingGarbage[retIndex] = res;
-				retIndex++;
-			}
+			m_pinnedGarbage[retIndex] = res;
+			retIndex++;
 		}
-		m_dumpingGarbage.resize(retIndex);
-		m_loadingGarbage.swap(m_dumpingGarbage);
-		m_dumpingFrame = m_loadingFrame.load();
-		if (force >= GC_FORCE_COMPLETE)
+	}
+	m_pinnedGarbage.resize(retIndex);
+
+	auto reclaim = [this, force](GPUResourceHandle* res)
+	{
+		if (force < GC_FORCE_PINNED && res->IsPinned())
 		{
-			for (uint32_t i = 0; i < m_dumpingGarbage.size(); i++)
-			{
-				GPUResourceHandle* res = m_dumpingGarbage[i];
-				res->Deallocate(this);
-				delete res;
-			}
-			m_dumpingGarbage.clear();
+			m_pinnedGarbage.push_back(res);
+			return;
 		}
-	}
+		Reclaim(res, force);
+	};
+	if (force >= GC_FORCE_UNSAFE)
+		m_garbage.CollectAll(reclaim);
+	else
+		m_garbage.Collect(m_dumpFrame.load(), reclaim);
+
+	if (force == GC_FORCE_NONE)
+		m_resourceCache.Trim(this, m_loadingFrame.load());
+}
+
+//Only resources the GPU is known to be done with are recycled, forced collections destroy
+void Engine::Reclaim(GPUResourceHandle* res, const GCForce force)
+{
+	if (force == GC_FORCE_NONE && res->Recycle(this, m_loadingFrame.load(std::memory_order_relaxed)))
+		return;
+	res->Deallocate(this);
+	delete res;
+}
+
+void Engine::AdvanceFrame(unsigned long long currentFrame, unsigned long long safeFrame)
+{
+	m_loadingFrame.store(currentFrame);
+	m_dumpFrame.store(safeFrame > SAFE_DUMP_MARGIN ? safeFrame - SAFE_DUMP_MARGIN : 0);
 }
 
 #pragma region FUNCTION_EXPORTS
@@ -814,6 +1330,13 @@ EXPORT void SetComputeShaders(Engine* instance, char* analysis, int analysisSize
 	instance->SetComputeShaders(surfaceAnalysis, surfaceAssembly);
 }
 
+EXPORT void SetCullShaders(Engine* instance, char* cull, int cullSize, char* pyramid, int pyramidSize)
+{
+	std::vector<char> chunkCull(cull, cull + cullSize);
+	std::vector<char> depthPyramid(pyramid, pyramid + pyramidSize);
+	instance->SetCullShaders(chunkCull, depthPyramid);
+}
+
 EXPORT void SetMaterialResources(Engine* instance, void* attributesBuffer, uint32_t attribsByteCount,
 	void* colorSpecData, uint32_t csWidth, uint32_t csHeight,
 	void* nrmHeightData, uint32_t nhWidth, uint32_t nhHeight,
@@ -840,6 +1363,56 @@ EXPORT void ClearRender(Engine* instance)
 	instance->ClearRender();
 }
 
+EXPORT void SetBuildBudget(Engine* instance, uint32_t budget)
+{
+	instance->SetBuildBudget(budget);
+}
+
+EXPORT void SetStagingBudget(Engine* instance, uint64_t byteBudget)
+{
+	instance->SetStagingBudget(byteBudget);
+}
+
+EXPORT void SetMeshOptimization(Engine* instance, bool enabled)
+{
+	instance->SetMeshOptimization(enabled);
+}
+
+EXPORT void SetJobWorkerCount(Engine* instance, uint32_t count)
+{
+	instance->SetJobWorkerCount(count);
+}
+
+EXPORT void GetStagingStats(Engine* instance, StagingPoolStats* stats)
+{
+	*stats = instance->GetStagingStats();
+}
+
+EXPORT void GetMeshArenaStats(Engine* instance, MeshArenaStats* stats)
+{
+	*stats = instance->GetMeshArenaStats();
+}
+
+EXPORT void GetResourceCacheStats(Engine* instance, ResourceCacheStats* stats)
+{
+	*stats = instance->GetResourceCacheStats();
+}
+
+EXPORT void SetMemoryBudget(Engine* instance, uint64_t byteBudget)
+{
+	instance->SetMemoryBudget(byteBudget);
+}
+
+EXPORT void SetMemoryHysteresis(Engine* instance, uint32_t stepFrames, float releaseFraction)
+{
+	instance->SetMemoryHysteresis(stepFrames, releaseFraction);
+}
+
+EXPORT void GetMemoryStats(Engine* instance, MemoryStats* stats)
+{
+	*stats = instance->GetMemoryStats();
+}
+
 EXPORT void SubmitQueue(Engine* instance, uint8_t queueIndex)
 {
 	instance->SubmitQueue(queueIndex);
@@ -880,7 +1453,10 @@ EXPORT void InvokeGC(Engine* instance)
 static void UNITY_INTERFACE_API OnRenderEvent(int eventID, void* userData)
 {
 	Camera* camera = static_cast<Camera*>(userData);
-	camera->m_instance->Draw(camera);
+	if (eventID == 2)
+		camera->m_instance->Cull(camera);
+	else
+		camera->m_instance->Draw(camera);
 }
 
 extern "C" UnityRenderingEventAndData UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API GetRenderInjection()
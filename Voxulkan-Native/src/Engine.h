@@ -4,11 +4,15 @@
 #include "Resources/RenderPipeline.h"
 #include "Resources/ComputePipeline.h"
 #include "Resources/GPUBuffer.h"
+#include "Resources/MeshArena.h"
+#include "Resources/FrameBufferRing.h"
 #include "Resources/CommandBufferHandle.h"
 #include "Components/VoxelBody.h"
-#include "Containers/MutexList.h"
+#include "Containers/EpochGarbage.h"
 #include "Containers/MPMCQueue.h"
+#include "Containers/TripleBuffer.h"
 #include "Camera.h"
+#include "TaskScheduler.h"
 #include <map>
 #include <atomic>
 #include <glm/mat4x4.hpp>
@@ -25,6 +29,7 @@ typedef struct WorkerResource
 	VkFence m_queryFence = nullptr;
 	VkEvent m_queryEvent = nullptr;
 	uint8_t m_queueIndex = 0xFF;
+	uint8_t m_index = 0;//Selects the worker's render list
 } WorkerResource;
 
 typedef struct QueueResource
@@ -40,13 +45,18 @@ class Engine
 public:
 	friend class VoxelBody;
 	friend struct VoxelChunk;
+	friend class ChunkStagingPool;
+	friend struct ChunkStagingResources;
+	friend class ChunkBuildBatch;
 	Engine(IUnityGraphicsVulkan* unityVulkan);
+	Engine(const UnityVulkanInstance& instance);
 	void InitializeResources();
 	void ReleaseResources();
 
 	void RegisterQueues(std::vector<VkQueue> queues, const uint32_t& queueFamily, VkQueue occlusionQueue);
 	void SetSurfaceShaders(std::vector<char>& vertex, std::vector<char>& tessCtrl, std::vector<char>& tessEval, std::vector<char>& fragment);
 	void SetComputeShaders(const std::vector<char>& surfaceAnalysis, const std::vector<char>& surfaceAssembly);
+	void SetCullShaders(const std::vector<char>& chunkCull, const std::vector<char>& depthPyramid);
 	void SetMaterialResources(void* attributesBuffer, uint32_t attribsByteCount,
 		void* colorSpecData, uint32_t csWidth, uint32_t csHeight,
 		void* nrmHeightData, uint32_t nhWidth, uint32_t nhHeight,
@@ -57,6 +67,21 @@ public:
 	void SubmitQueue(uint8_t queueIndex);
 	void QueryOcclusion(Camera* camera);
 	void ClearRender();
+	void ScheduleBuilds();
+	inline void SetBuildBudget(uint32_t budget) { m_buildBudget = budget; }
+	inline void SetMultiDrawIndirect(bool enabled) { m_multiDrawIndirect = enabled; }
+	inline void SetIndirectFirstInstance(bool enabled) { m_indirectFirstInstance = enabled; }
+	inline void SetMeshOptimization(bool enabled) { m_meshOptimization = enabled; }
+	inline void SetJobWorkerCount(uint32_t count) { m_jobWorkerCount = count; }
+	void SetStagingBudget(uint64_t byteBudget);
+	StagingPoolStats GetStagingStats();
+	MeshArenaStats GetMeshArenaStats();
+	ResourceCacheStats GetResourceCacheStats();
+	inline void SetMemoryBudget(uint64_t byteBudget) { m_memoryGovernor.SetBudget(byteBudget); }
+	inline void SetMemoryHysteresis(uint32_t stepFrames, float releaseFraction) { m_memoryGovernor.SetHysteresis(stepFrames, releaseFraction); }
+	inline void SetMemoryBudgetExtension(bool enabled) { m_memoryGovernor.SetBudgetExtension(enabled); }
+	MemoryStats GetMemoryStats();
+	void Cull(Camera* camera);
 	void Draw(Camera* camera);
 	ComputePipeline* CreateFormPipeline(const std::vector<char>& shader);
 
@@ -70,23 +95,32 @@ public:
 		GC_FORCE_COMPLETE = 3
 	} GCForce;
 	void GarbageCollect(const GCForce force = GC_FORCE_NONE);
+	void AdvanceFrame(unsigned long long currentFrame, unsigned long long safeFrame);
 
 	inline const VkDevice& Device() { return m_instance.device; }
 	inline const VmaAllocator& Allocator() { return m_allocator; }
+	inline ResourceCache& Cache() { return m_resourceCache; }
+	inline MemoryGovernor& Governor() { return m_memoryGovernor; }
 
-	static const uint8_t CHUNK_SIZE = 31;
-	static const uint8_t CHUNK_PADDING = 2;
-	static const uint8_t WORKER_CMDB_COUNT = 3;
+	static constexpr uint8_t CHUNK_SIZE = 31;
+	static constexpr uint8_t CHUNK_PADDING = 2;
+	static constexpr uint8_t WORKER_CMDB_COUNT = 3;
 	static uint8_t GetWorkerCount();
 	
 private:
 	void InitializeRenderPipeline();
 	void InitializeComputePipelines();
-	void InitializeStagingResources(uint8_t poolSize);
+	void InitializeStagingResources(uint32_t minCount);
+
+	//Whether Cull culls chunks on the GPU, QueryOcclusion tests them on the CPU otherwise
+	bool GPUCulling();
+	uint32_t BuildDepthPyramid(Camera* camera, VkCommandBuffer commandBuffer);
+	void DrawCulled(Camera* camera, VkCommandBuffer commandBuffer, VkPipelineLayout layout);
 
 	void ReleaseRenderPipelines();
 	void ReleaseComputePipelines();
 	void ReleaseStagingResources();
+	void Reclaim(GPUResourceHandle* res, const GCForce force);
 
 	IUnityGraphicsVulkan* m_unityVulkan = nullptr;
 	UnityVulkanInstance m_instance = {};
@@ -99,31 +133,51 @@ private:
 	VkDescriptorSetLayout m_formDSetLayout = nullptr;
 	ComputePipeline m_surfaceAnalysisPipeline = {};
 	ComputePipeline m_surfaceAssemblyPipeline = {};
+	ComputePipeline m_chunkCullPipeline = {};
+	ComputePipeline m_depthPyramidPipeline = {};
+	VkSampler m_pointSampler = VK_NULL_HANDLE;
 	GPUBuffer m_surfaceAttributesBuffer = {};
 	GPUImage m_surfaceColorSpecTex = {};
 	GPUImage m_surfaceNrmHeightTex = {};
 
-	MutexList<BodyRenderPackage> m_render;
-	VkQueue m_occlusionQueue;
+	//Traversal fills the back frame, one list per worker, occlusion queries add each camera's view of it and ClearRender publishes it.
+	//The render thread draws the newest published frame without blocking either side.
+	TripleBuffer<std::vector<BodyRenderList>> m_renderFrames;
+	VkQueue m_occlusionQueue = nullptr;
 	std::mutex m_occlusionLock;
 
 	MPMCQueue<WorkerResource*>* m_workers = nullptr;
+	TaskScheduler* m_scheduler = nullptr;
+	uint32_t m_jobWorkerCount = 0;//Host job threads that traverse bodies, the scheduler only takes the cores they leave. Set before InitializeResources
 
 	QueueResource* m_queues = nullptr;
 	uint8_t m_queueCount = 0;
 
 	uint32_t m_computeQueueFamily = 0;
 
-	MPMCQueue<ChunkStagingResources*>* m_stagingResources = nullptr;
-	VkDescriptorPool m_stagingDescriptorPool = nullptr;
+	ChunkStagingPool* m_stagingPool = nullptr;
+	MeshArena* m_meshArena = nullptr;//Vertex and index ranges of every chunk
+	ResourceCache m_resourceCache;//Collected buffers and images waiting to be reused, see GPUBuffer::m_recycle
+	MemoryGovernor m_memoryGovernor;//Device memory per category, coarsens traversal when over budget
+	FrameBufferRing m_drawCommandRing = FrameBufferRing(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	FrameBufferRing m_cullInputRing = FrameBufferRing(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	FrameBufferRing m_cullOutputRing = FrameBufferRing(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	std::vector<glm::mat4x4> m_cullBodies = {};
+	bool m_multiDrawIndirect = false;//Device feature, without it every indirect draw holds a single command
+	bool m_indirectFirstInstance = false;//Device feature, without it chunks are drawn directly as firstInstance selects their vertex header
+	VkDescriptorPool m_renderDescriptorPool = nullptr;
+	ChunkBuildQueue m_buildQueue;
+	uint32_t m_buildBudget = 50;//New builds started per frame
+	bool m_meshOptimization = false;//Finished chunk meshes are reordered for the vertex cache on the way to the screen, see MeshOptimizer
 
 #define SAFE_DUMP_MARGIN 10
 	typedef unsigned long long FrameNumber;
-	MutexList<GPUResourceHandle*> m_loadingGarbage;
-	std::vector<GPUResourceHandle*>  m_dumpingGarbage;
+	EpochGarbage<GPUResourceHandle*> m_garbage;//Retired resources tagged with m_loadingFrame, reclaimed once it reaches m_dumpFrame
+	std::vector<GPUResourceHandle*> m_pinnedGarbage;//Safe but still pinned, rechecked every collection
 	std::atomic<FrameNumber> m_loadingFrame;
 	std::atomic<FrameNumber> m_dumpFrame;
-	FrameNumber m_dumpingFrame;
 };
 
-extern PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSet;
\ No newline at end of file
+extern PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSet;
+extern PFN_vkCmdDrawIndexedIndirectCountKHR vkCmdDrawIndexedIndirectCountFn;//Null without VK_KHR_draw_indirect_count
+extern PFN_vkGetPhysicalDeviceMemoryProperties2KHR vkGetPhysicalDeviceMemoryProperties2Fn;//Null without VK_KHR_get_physical_device_properties2
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "HeadlessHost.h"
+#include "..//Engine.h"
+#include "..//Plugin.h"
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+bool HeadlessHost::Initialize(const std::string& shaderDirectory)
+{
+	m_shaderDirectory = shaderDirectory;
+	if (!CreateDevice())
+		return false;
+	return InitializeEngine();
+}
+
+bool HeadlessHost::CreateDevice()
+{
+	VkApplicationInfo appInfo = {};
+	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	appInfo.pApplicationName = "VoxulkanHeadless";
+	appInfo.pEngineName = "Voxulkan";
+	appInfo.apiVersion = VK_API_VERSION_1_1;
+
+	VkInstanceCreateInfo instanceCI = {};
+	instanceCI.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instanceCI.pApplicationInfo = &appInfo;
+	if (vkCreateInstance(&instanceCI, nullptr, &m_instance.instance) != VK_SUCCESS)
+	{
+		LOG("Failed to create Vulkan instance");
+		return false;
+	}
+
+	uint32_t deviceCount = 0;
+	vkEnumeratePhysicalDevices(m_instance.instance, &deviceCount, nullptr);
+	std::vector<VkPhysicalDevice> devices(deviceCount);
+	vkEnumeratePhysicalDevices(m_instance.instance, &deviceCount, devices.data());
+
+	//Pick the first device that exposes push descriptors and a graphics+compute family
+	uint32_t family = UINT32_MAX;
+	uint32_t familyQueueCount = 0;
+	for (VkPhysicalDevice device : devices)
+	{
+		uint32_t extCount = 0;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extCount, nullptr);
+		std::vector<VkExtensionProperties> exts(extCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extCount, exts.data());
+		bool pushDescriptors = false;
+		for (const VkExtensionProperties& ext : exts)
+			pushDescriptors |= strcmp(ext.extensionName, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME) == 0;
+		if (!pushDescriptors)
+			continue;
+
+		uint32_t qfCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &qfCount, nullptr);
+		std::vector<VkQueueFamilyProperties> qfProps(qfCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &qfCount, qfProps.data());
+		for (uint32_t i = 0; i < qfCount; i++)
+		{
+			const VkQueueFlags required = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+			if ((qfProps[i].queueFlags & required) == required)
+			{
+				family = i;
+				familyQueueCount = qfProps[i].queueCount;
+				break;
+			}
+		}
+
+		if (family != UINT32_MAX)
+		{
+			m_instance.physicalDevice = device;
+			break;
+		}
+	}
+
+	if (m_instance.physicalDevice == nullptr)
+	{
+		LOG("No Vulkan device with push descriptors and a graphics/compute queue family");
+		return false;
+	}
+
+	//Mirror Hook_vkCreateDevice: graphics queue 0, occlusion queue 1 and the rest for compute.
+	//Software ICDs usually expose a single queue so everything shares it (the host is single threaded).
+	uint32_t queueCount = std::min(familyQueueCount, 2U + Engine::GetWorkerCount());
+	std::vector<float> priorities(queueCount, 1.0f);
+	VkDeviceQueueCreateInfo queueCI = {};
+	queueCI.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueCI.queueFamilyIndex = family;
+	queueCI.queueCount = queueCount;
+	queueCI.pQueuePriorities = priorities.data();
+
+	VkPhysicalDeviceFeatures supported = {};
+	vkGetPhysicalDeviceFeatures(m_instance.physicalDevice, &supported);
+	VkPhysicalDeviceFeatures features = {};
+	features.tessellationShader = supported.tessellationShader;
+	features.fillModeNonSolid = supported.fillModeNonSolid;
+	features.multiDrawIndirect = supported.multiDrawIndirect;
+	features.drawIndirectFirstInstance = supported.drawIndirectFirstInstance;
+	m_multiDrawIndirect = supported.multiDrawIndirect;
+	m_indirectFirstInstance = supported.drawIndirectFirstInstance;
+
+	const char* extensions[] = { VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME };
+	VkDeviceCreateInfo deviceCI = {};
+	deviceCI.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceCI.queueCreateInfoCount = 1;
+	deviceCI.pQueueCreateInfos = &queueCI;
+	deviceCI.enabledExtensionCount = 1;
+	deviceCI.ppEnabledExtensionNames = extensions;
+	deviceCI.pEnabledFeatures = &features;
+	if (vkCreateDevice(m_instance.physicalDevice, &deviceCI, nullptr, &m_instance.device) != VK_SUCCESS)
+	{
+		LOG("Failed to create Vulkan device");
+		return false;
+	}
+
+	m_instance.queueFamilyIndex = family;
+	m_instance.getInstanceProcAddr = vkGetInstanceProcAddr;
+	vkGetDeviceQueue(m_instance.device, family, 0, &m_instance.graphicsQueue);
+	vkGetDeviceQueue(m_instance.device, family, std::min(1U, queueCount - 1), &m_occlusionQueue);
+	for (uint32_t i = 2; i < queueCount; i++)
+	{
+		VkQueue queue;
+		vkGetDeviceQueue(m_instance.device, family, i, &queue);
+		m_computeQueues.push_back(queue);
+	}
+	if (m_computeQueues.empty())
+		m_computeQueues.push_back(m_instance.graphicsQueue);
+
+	vkCmdPushDescriptorSet = (PFN_vkCmdPushDescriptorSetKHR)vkGetDeviceProcAddr(m_instance.device, "vkCmdPushDescriptorSetKHR");
+	return vkCmdPushDescriptorSet != nullptr;
+}
+
+bool HeadlessHost::LoadShader(const std::string& path, std::vector<char>& bytes)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		LOG("Failed to open shader " + path);
+		return false;
+	}
+	bytes.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(bytes.data(), bytes.size());
+	return true;
+}
+
+bool HeadlessHost::InitializeEngine()
+{
+	std::vector<char> vertex, tessCtrl, tessEval, fragment, analysis, assembly;
+	const std::string& dir = m_shaderDirectory;
+	if (!LoadShader(dir + "/Surface.vert.bytes", vertex) ||
+		!LoadShader(dir + "/Surface.tesc.bytes", tessCtrl) ||
+		!LoadShader(dir + "/Surface.tese.bytes", tessEval) ||
+		!LoadShader(dir + "/Surface.frag.bytes", fragment) ||
+		!LoadShader(dir + "/SurfaceAnalysis.comp.bytes", analysis) ||
+		!LoadShader(dir + "/SurfaceAssembly.comp.bytes", assembly))
+		return false;
+
+	m_engine = new Engine(m_instance);
+	m_engine->RegisterQueues(m_computeQueues, m_instance.queueFamilyIndex, m_occlusionQueue);
+	m_engine->SetMultiDrawIndirect(m_multiDrawIndirect);
+	m_engine->SetIndirectFirstInstance(m_indirectFirstInstance);
+	m_engine->SetSurfaceShaders(vertex, tessCtrl, tessEval, fragment);
+	m_engine->SetComputeShaders(analysis, assembly);
+
+	//Single 1x1 placeholder material, matches the 32 byte VoxelMaterialAttributes on the C# side
+	uint8_t attributes[32] = {};
+	uint32_t colorSpec = 0xFFFFFFFF;
+	uint32_t nrmHeight = 0x80FF8080;
+	m_engine->SetMaterialResources(attributes, sizeof(attributes),
+		&colorSpec, 1, 1,
+		&nrmHeight, 1, 1,
+		1);
+	m_engine->InitializeResources();
+	return true;
+}
+
+void HeadlessHost::AdvanceFrame()
+{
+	m_frame++;
+	m_engine->AdvanceFrame(m_frame, m_frame > Engine::WORKER_CMDB_COUNT ? m_frame - Engine::WORKER_CMDB_COUNT : 0);
+}
+
+void HeadlessHost::Release()
+{
+	if (m_engine)
+	{
+		m_engine->ReleaseResources();
+		delete m_engine;
+		m_engine = nullptr;
+	}
+	if (m_instance.device)
+		vkDestroyDevice(m_instance.device, nullptr);
+	if (m_instance.instance)
+		vkDestroyInstance(m_instance.instance, nullptr);
+	m_instance = {};
+	m_computeQueues.clear();
+	m_occlusionQueue = nullptr;
+}
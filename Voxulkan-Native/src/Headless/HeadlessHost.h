@@ -0,0 +1,36 @@
+#pragma once
+#include "IUnityGraphicsVulkan.h"
+#include <string>
+#include <vector>
+
+class Engine;
+
+//Owns the Vulkan instance/device that Unity would otherwise provide through the plugin hooks.
+//Used to run the engine core without a Unity player (CI, profiling, software ICDs such as lavapipe).
+class HeadlessHost
+{
+public:
+	bool Initialize(const std::string& shaderDirectory);
+	void Release();
+
+	static bool LoadShader(const std::string& path, std::vector<char>& bytes);
+
+	inline Engine* GetEngine() { return m_engine; }
+	inline const std::string& ShaderDirectory() { return m_shaderDirectory; }
+
+	//Simulates the frame counters Unity hands to Engine::Draw
+	void AdvanceFrame();
+
+private:
+	bool CreateDevice();
+	bool InitializeEngine();
+
+	std::string m_shaderDirectory;
+	UnityVulkanInstance m_instance = {};
+	std::vector<VkQueue> m_computeQueues;
+	VkQueue m_occlusionQueue = nullptr;
+	bool m_multiDrawIndirect = false;
+	bool m_indirectFirstInstance = false;
+	Engine* m_engine = nullptr;
+	unsigned long long m_frame = 0;
+};
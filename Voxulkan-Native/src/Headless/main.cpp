@@ -0,0 +1,86 @@
+#include "HeadlessHost.h"
+#include "..//Engine.h"
+#include "..//Plugin.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+extern "C" void RegisterLogCallback(void(*logCallback)(const char* msg));
+
+static void PrintLog(const char* msg)
+{
+	printf("%s\n", msg);
+}
+
+//Usage: VoxulkanHeadless <NativeShaders dir> [frames] [error threshold]
+//Runs the same body setup as VoxelSystem.OnNativeInitialized with an observer flying through it.
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: %s <shader directory> [frames] [error threshold]\n", argv[0]);
+		return 1;
+	}
+	uint32_t frameCount = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 300;
+	float E = argc > 3 ? static_cast<float>(atof(argv[3])) : 100.0f;
+
+	RegisterLogCallback(PrintLog);
+
+	HeadlessHost host;
+	if (!host.Initialize(argv[1]))
+	{
+		host.Release();
+		return 1;
+	}
+	Engine* engine = host.GetEngine();
+
+	std::vector<char> sphereForm;
+	if (!HeadlessHost::LoadShader(host.ShaderDirectory() + "/SphereForm.comp.bytes", sphereForm))
+	{
+		host.Release();
+		return 1;
+	}
+
+	BodyForm form = {};
+	form.min = glm::vec3(-900.0f);
+	form.max = glm::vec3(900.0f);
+	form.formCompute = engine->CreateFormPipeline(sphereForm);
+	form.shellInner = 740.0f;//SphereForm.comp: radius 800, noise moves the surface by at most 50
+	form.shellOuter = 860.0f;
+
+	VoxelBody* body = new VoxelBody(form.min, form.max);
+
+	double traverseTotal = 0.0;
+	double submitTotal = 0.0;
+	for (uint32_t frame = 0; frame < frameCount; frame++)
+	{
+		float t = frameCount > 1 ? static_cast<float>(frame) / (frameCount - 1) : 0.0f;
+		glm::vec3 observer = glm::vec3(0.0f, 0.0f, 2000.0f * (1.0f - t));
+
+		auto t0 = Clock::now();
+		body->Traverse(engine, observer, E, 1.0f, &form, 1);
+		auto t1 = Clock::now();
+		for (uint8_t q = 0; q < engine->GetQueueCount(); q++)
+			engine->SubmitQueue(q);
+		engine->ClearRender();
+		auto t2 = Clock::now();
+
+		host.AdvanceFrame();
+		engine->GarbageCollect();
+
+		traverseTotal += std::chrono::duration<double, std::milli>(t1 - t0).count();
+		submitTotal += std::chrono::duration<double, std::milli>(t2 - t1).count();
+	}
+
+	printf("Frames: %u\n", frameCount);
+	printf("Traverse: %.3f ms/frame\n", frameCount ? traverseTotal / frameCount : 0.0);
+	printf("Submit:   %.3f ms/frame\n", frameCount ? submitTotal / frameCount : 0.0);
+
+	body->Deallocate(engine);
+	delete body;
+	SAFE_DEL_DEALLOC(form.formCompute, engine);
+	host.Release();
+	return 0;
+}
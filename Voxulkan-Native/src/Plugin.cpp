@@ -5,8 +5,11 @@
 #include <ctime>
 #include <sstream>
 #include <algorithm>
+#include <cstring>
 
+#ifdef _MSC_VER
 #pragma warning(disable : 4996)
+#endif
 
 typedef void(*logMSG_t) (const char* msg);
 logMSG_t logMsg;
@@ -49,11 +52,17 @@ static Engine* s_Engine;
 static uint32_t s_ComputeFamilyIndex;
 static std::vector<VkQueue> s_ComputeQueues;
 static VkQueue s_OcclusionQueue;
+static bool s_MultiDrawIndirect = false;
+static bool s_IndirectFirstInstance = false;
+static bool s_MemoryBudget = false;
 
 EXPORT void CreateVoxulkanInstance(Engine*& instance)
 {
 	instance = new Engine(s_Vulkan);
 	instance->RegisterQueues(s_ComputeQueues, s_ComputeFamilyIndex, s_OcclusionQueue);
+	instance->SetMultiDrawIndirect(s_MultiDrawIndirect);
+	instance->SetIndirectFirstInstance(s_IndirectFirstInstance);
+	instance->SetMemoryBudgetExtension(s_MemoryBudget);
 }
 EXPORT void DestroyVoxulkanInstance(Engine*& instance)
 {
@@ -75,6 +84,9 @@ static void UNITY_INTERFACE_API OnGraphicsDeviceEvent(UnityGfxDeviceEventType ev
 		eventConfig.renderPassPrecondition = kUnityVulkanRenderPass_EnsureInside;
 		eventConfig.flags = kUnityVulkanEventConfigFlag_EnsurePreviousFrameSubmission | kUnityVulkanEventConfigFlag_ModifiesCommandBuffersState;
 		s_Vulkan->ConfigureEvent(1, &eventConfig);
+		//Culling records compute work ahead of the draw and must stay outside of the render pass
+		eventConfig.renderPassPrecondition = kUnityVulkanRenderPass_EnsureOutside;
+		s_Vulkan->ConfigureEvent(2, &eventConfig);
 		break;
 	}
 	case kUnityGfxDeviceEventShutdown:
@@ -210,14 +222,54 @@ static VKAPI_ATTR VkResult VKAPI_CALL Hook_vkCreateDevice(VkPhysicalDevice physi
 	std::vector<const char*> extensions(newCInfo.ppEnabledExtensionNames, newCInfo.ppEnabledExtensionNames + newCInfo.enabledExtensionCount);
 	extensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
 
+	//GPU culled runs are drawn with a device side count when available
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> supportedExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, supportedExtensions.data());
+	bool drawIndirectCount = false;
+	bool memoryBudget = false;
+	for (const VkExtensionProperties& extension : supportedExtensions)
+	{
+		drawIndirectCount |= strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0;
+		memoryBudget |= strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+	}
+	if (drawIndirectCount)
+		extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	//MemoryGovernor reads the heap budgets when available, Unity may have enabled it already
+	bool memoryBudgetEnabled = false;
+	for (const char* name : extensions)
+		memoryBudgetEnabled |= strcmp(name, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+	if (memoryBudget && !memoryBudgetEnabled)
+		extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
 	newCInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
 	newCInfo.ppEnabledExtensionNames = extensions.data();
 
+	//Chunks are drawn with one indirect draw per body when multi draw is available
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	VkPhysicalDeviceFeatures enabledFeatures = {};
+	if (newCInfo.pEnabledFeatures)
+		enabledFeatures = *newCInfo.pEnabledFeatures;
+	if (newCInfo.pEnabledFeatures || !newCInfo.pNext)//Features chained through pNext are left as they are
+	{
+		enabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		enabledFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		newCInfo.pEnabledFeatures = &enabledFeatures;
+	}
+	s_MultiDrawIndirect = newCInfo.pEnabledFeatures && newCInfo.pEnabledFeatures->multiDrawIndirect;
+	s_IndirectFirstInstance = newCInfo.pEnabledFeatures && newCInfo.pEnabledFeatures->drawIndirectFirstInstance;
+
 	VkResult result = vkCreateDevice(physicalDevice, &newCInfo, pAllocator, pDevice);
 	if (result != VK_SUCCESS)
 		LOG("Device creation failed!");
 
 	SAFE_DEL_ARR(priorities);
+
+	if (result == VK_SUCCESS && drawIndirectCount)
+		vkCmdDrawIndexedIndirectCountFn = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(*pDevice, "vkCmdDrawIndexedIndirectCountKHR");
+	s_MemoryBudget = result == VK_SUCCESS && memoryBudget;
 	
 	vkGetDeviceQueue(*pDevice, uQueueInfo.queueFamilyIndex, 1, &s_OcclusionQueue);
 	s_ComputeQueues = std::vector<VkQueue>(queueCount);
@@ -229,6 +281,8 @@ static VKAPI_ATTR VkResult VKAPI_CALL Hook_vkCreateDevice(VkPhysicalDevice physi
 }
 
 PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSet = nullptr;
+PFN_vkCmdDrawIndexedIndirectCountKHR vkCmdDrawIndexedIndirectCountFn = nullptr;
+PFN_vkGetPhysicalDeviceMemoryProperties2KHR vkGetPhysicalDeviceMemoryProperties2Fn = nullptr;
 
 static VKAPI_ATTR VkResult VKAPI_CALL Hook_vkCreateInstance(const VkInstanceCreateInfo* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkInstance* pInstance)
 {
@@ -253,6 +307,7 @@ static VKAPI_ATTR VkResult VKAPI_CALL Hook_vkCreateInstance(const VkInstanceCrea
 		LOG("Instance creation failed!");
 
 	vkCmdPushDescriptorSet = (PFN_vkCmdPushDescriptorSetKHR)vkGetInstanceProcAddr(*pInstance, "vkCmdPushDescriptorSetKHR");
+	vkGetPhysicalDeviceMemoryProperties2Fn = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(*pInstance, "vkGetPhysicalDeviceMemoryProperties2KHR");
 
 	return result;
 }
@@ -5,7 +5,11 @@
 #define SAFE_DEL_ARR(s) if(s) delete[] s; s = nullptr
 #define SAFE_DEL(s) if(s) delete s; s = nullptr
 #define SAFE_DEL_DEALLOC(s, i) if(s){ s->Release(i); delete s;} s = nullptr
+#ifdef _WIN32
 #define EXPORT extern "C" __declspec(dllexport)
+#else
+#define EXPORT extern "C" __attribute__((visibility("default")))
+#endif
 
 void Log(const std::string& msg);
 
@@ -0,0 +1,81 @@
+#include "FrameBufferRing.h"
+#include "..//Engine.h"
+#include "..//Plugin.h"
+#include <cstring>
+
+#define ALIGN_UP(size) (((size) + FRAME_RING_ALIGNMENT - 1) & ~(FRAME_RING_ALIGNMENT - 1))
+
+FrameBufferRing::FrameBufferRing(VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+{
+	m_usage = usage;
+	m_memoryUsage = memoryUsage;
+}
+
+void FrameBufferRing::Release(Engine* instance)
+{
+	for (FrameBuffer& slot : m_frames)
+	{
+		slot.buffer.Release(instance);
+		slot = FrameBuffer();
+	}
+	m_current = nullptr;
+}
+
+bool FrameBufferRing::Reserve(Engine* instance, unsigned long long frame, unsigned long long safeFrame, VkDeviceSize byteCount, VkBuffer& buffer, VkDeviceSize& offset)
+{
+	FrameBuffer& slot = m_frames[frame % FRAME_RING_FRAMES];
+	if (slot.frame != frame)
+	{
+		if (slot.buffer.m_gpuHandle && slot.frame > safeFrame)//Still read by a frame in flight
+			slot.buffer.Release(instance);
+		slot.frame = frame;
+		slot.used = 0;
+	}
+
+	byteCount = ALIGN_UP(std::max(byteCount, (VkDeviceSize)1));
+	if (!slot.buffer.m_gpuHandle || slot.used + byteCount > slot.capacity)
+	{
+		VkDeviceSize capacity = std::max(std::max(slot.capacity * 2, slot.used + byteCount), (VkDeviceSize)FRAME_RING_MIN_SIZE);
+		slot.buffer.Release(instance);
+		Allocate(instance, slot, capacity);
+		if (!slot.buffer.Allocated())
+		{
+			slot.buffer.Release(instance);
+			slot.capacity = 0;
+			m_current = nullptr;
+			buffer = VK_NULL_HANDLE;
+			return false;
+		}
+	}
+
+	m_current = &slot;
+	buffer = slot.buffer.m_gpuHandle->m_buffer;
+	offset = slot.used;
+	slot.used += byteCount;
+	return true;
+}
+
+void FrameBufferRing::Upload(Engine* instance, VkDeviceSize offset, const void* data, VkDeviceSize byteCount)
+{
+	if (!m_current || byteCount == 0)
+		return;
+
+	VmaAllocator allocator = instance->Allocator();
+	VmaAllocation allocation = m_current->buffer.m_gpuHandle->m_allocation;
+	void* mappedData;
+	vmaMapMemory(allocator, allocation, &mappedData);
+	std::memcpy((char*)mappedData + offset, data, byteCount);
+	vmaFlushAllocation(allocator, allocation, offset, byteCount);
+	vmaUnmapMemory(allocator, allocation);
+}
+
+void FrameBufferRing::Allocate(Engine* instance, FrameBuffer& slot, VkDeviceSize capacity)
+{
+	slot.buffer.m_bufferUsage = m_usage;
+	slot.buffer.m_memoryUsage = m_memoryUsage;
+	slot.buffer.m_byteCount = capacity;
+	slot.buffer.m_recycle = true;
+	slot.buffer.Allocate(instance);
+	slot.capacity = slot.buffer.m_byteCount;
+	slot.used = 0;
+}
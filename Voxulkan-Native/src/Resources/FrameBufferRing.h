@@ -0,0 +1,36 @@
+#pragma once
+#include "GPUBuffer.h"
+
+#define FRAME_RING_FRAMES 4
+#define FRAME_RING_ALIGNMENT 256ULL //Reservations can be bound as storage buffers
+#define FRAME_RING_MIN_SIZE (256ULL << 10)
+
+//Per-frame transient GPU data, one growing buffer per frame in flight.
+//Every reservation of a frame is carved from the same buffer, a buffer the GPU may still read is replaced and left to the garbage collector.
+class FrameBufferRing
+{
+public:
+	FrameBufferRing(VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
+	void Release(Engine* instance);
+
+	//Room for byteCount bytes in the buffer of frame at offset, false if the buffer could not grow
+	bool Reserve(Engine* instance, unsigned long long frame, unsigned long long safeFrame, VkDeviceSize byteCount, VkBuffer& buffer, VkDeviceSize& offset);
+	//Writes into the buffer of the last reservation, host visible rings only
+	void Upload(Engine* instance, VkDeviceSize offset, const void* data, VkDeviceSize byteCount);
+
+private:
+	struct FrameBuffer
+	{
+		GPUBuffer buffer = {};
+		unsigned long long frame = 0;
+		VkDeviceSize capacity = 0;
+		VkDeviceSize used = 0;
+	};
+
+	void Allocate(Engine* instance, FrameBuffer& slot, VkDeviceSize capacity);
+
+	VkBufferUsageFlags m_usage = 0;
+	VmaMemoryUsage m_memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	FrameBuffer m_frames[FRAME_RING_FRAMES] = {};
+	FrameBuffer* m_current = nullptr;
+};
@@ -1,6 +1,7 @@
 #include "GPUBuffer.h"
-#include "..\\Engine.h"
-#include "..\\Plugin.h"
+#include "..//Engine.h"
+#include "..//Plugin.h"
+#include <cstring>
 
 
 void GPUBuffer::UploadData(Engine* instance, void* data, size_t byteCount)
@@ -19,7 +20,22 @@ void GPUBuffer::Allocate(Engine* instance)
 		LOG("GPU buffer allocation failed! Already allocated!");
 		return;
 	}
+
+	ResourceCacheKey key = {};
+	if (m_recycle)
+	{
+		m_byteCount = ResourceCache::BufferClass(m_byteCount);
+		key.kind = RESOURCE_CACHE_BUFFER;
+		key.usage = m_bufferUsage;
+		key.memoryUsage = m_memoryUsage;
+		key.size = m_byteCount;
+		m_gpuHandle = static_cast<GPUBufferHandle*>(instance->Cache().Acquire(key));
+		if (m_gpuHandle)
+			return;
+	}
 	m_gpuHandle = new GPUBufferHandle();
+	m_gpuHandle->m_cacheKey = key;
+	m_gpuHandle->m_category = m_category;
 
 	VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
 	bufferInfo.size = m_byteCount;
@@ -29,7 +45,18 @@ void GPUBuffer::Allocate(Engine* instance)
 	VmaAllocationCreateInfo allocInfo = {};
 	allocInfo.usage = m_memoryUsage;
 
-	vmaCreateBuffer(instance->Allocator(), &bufferInfo, &allocInfo, &m_gpuHandle->m_buffer, &m_gpuHandle->m_allocation, nullptr);
+	VmaAllocationInfo allocationInfo;
+	VkResult result = vmaCreateBuffer(instance->Allocator(), &bufferInfo, &allocInfo, &m_gpuHandle->m_buffer, &m_gpuHandle->m_allocation, &allocationInfo);
+	if (result != VK_SUCCESS)
+	{
+		LOG("GPU buffer allocation failed! VkResult " + std::to_string(result));
+		m_gpuHandle->m_buffer = nullptr;
+		m_gpuHandle->m_allocation = nullptr;
+		instance->Governor().AllocationFailed();
+		return;
+	}
+	m_gpuHandle->m_trackedBytes = allocationInfo.size;
+	instance->Governor().Track(m_category, (int64_t)allocationInfo.size);
 }
 
 void GPUBuffer::Release(Engine* instance)
@@ -41,7 +68,17 @@ void GPUBufferHandle::Deallocate(Engine* instance)
 {
 	if (m_buffer)
 		vmaDestroyBuffer(instance->Allocator(), m_buffer, m_allocation);
+	if (m_trackedBytes)
+		instance->Governor().Track(m_category, -(int64_t)m_trackedBytes);
+	m_trackedBytes = 0;
 
 	m_buffer = nullptr;
 	m_allocation = nullptr;
 }
+
+bool GPUBufferHandle::Recycle(Engine* instance, unsigned long long frame)
+{
+	if (m_cacheKey.kind == RESOURCE_CACHE_NONE || !m_buffer)
+		return false;
+	return instance->Cache().Return(this, m_cacheKey, m_cacheKey.size, frame);
+}
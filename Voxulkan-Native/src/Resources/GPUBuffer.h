@@ -1,12 +1,19 @@
 #pragma once
 #include "GPUResource.h"
+#include "ResourceCache.h"
+#include "MemoryGovernor.h"
 
 struct GPUBufferHandle : GPUResourceHandle
 {
 	VkBuffer m_buffer = VK_NULL_HANDLE;
 	VmaAllocation m_allocation = VK_NULL_HANDLE;
+	VkDeviceSize m_offset = 0;//Start of the data in m_buffer, see MeshRangeHandle
+	ResourceCacheKey m_cacheKey = {};//Set when allocated with GPUBuffer::m_recycle
+	MemoryCategory m_category = MEMORY_CATEGORY_OTHER;
+	VkDeviceSize m_trackedBytes = 0;//Reported to MemoryGovernor
 
 	void Deallocate(Engine* instance) override;
+	bool Recycle(Engine* instance, unsigned long long frame) override;
 };
 
 class GPUBuffer : public GPUResource
@@ -17,6 +24,8 @@ public:
 	void Allocate(Engine* instance) override;
 	void Release(Engine* instance) override;
 	inline VkBuffer GetVk() { return m_gpuHandle ? m_gpuHandle->m_buffer : nullptr; }
+	//False after a failed Allocate, the empty handle still has to be released
+	inline bool Allocated() const { return m_gpuHandle && m_gpuHandle->m_buffer; }
 	inline void Dereference() { m_gpuHandle = nullptr; }
 
 	GPUBufferHandle* m_gpuHandle = nullptr;
@@ -25,4 +34,6 @@ public:
 	VmaMemoryUsage m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
 	VkBufferUsageFlags m_bufferUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 	VkDeviceSize m_byteCount = 0;
+	bool m_recycle = false;//Taken from and given back to ResourceCache, m_byteCount is rounded up to its size class
+	MemoryCategory m_category = MEMORY_CATEGORY_OTHER;
 };
\ No newline at end of file
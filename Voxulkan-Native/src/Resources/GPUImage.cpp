@@ -10,12 +10,22 @@ void GPUImageHandle::Deallocate(Engine* instance)
 		vkDestroySampler(instance->Device(), m_sampler, nullptr);
 	if (m_image)
 		vmaDestroyImage(instance->Allocator(), m_image, m_allocation);
+	if (m_trackedBytes)
+		instance->Governor().Track(m_category, -(int64_t)m_trackedBytes);
+	m_trackedBytes = 0;
 
 	m_sampler = nullptr;
 	m_image = nullptr;
 	m_allocation = nullptr;
 }
 
+bool GPUImageHandle::Recycle(Engine* instance, unsigned long long frame)
+{
+	if (m_cacheKey.kind == RESOURCE_CACHE_NONE || !m_image)
+		return false;
+	return instance->Cache().Return(this, m_cacheKey, m_trackedBytes, frame);
+}
+
 void GPUImage::Allocate(Engine* instance)
 {
 	if (m_gpuHandle)
@@ -23,7 +33,26 @@ void GPUImage::Allocate(Engine* instance)
 		LOG("GPU image allocation failed! Already allocated!");
 		return;
 	}
+
+	ResourceCacheKey key = {};
+	if (m_recycle && !m_createSampler)
+	{
+		key.kind = RESOURCE_CACHE_IMAGE;
+		key.usage = m_usage;
+		key.memoryUsage = m_memoryUsage;
+		key.format = m_format;
+		key.type = m_type;
+		key.viewType = m_createView ? (uint32_t)m_viewType : UINT32_MAX;
+		key.tiling = m_tiling;
+		key.arraySize = m_arraySize;
+		key.size = (uint64_t)m_size.width | ((uint64_t)m_size.height << 21) | ((uint64_t)m_size.depth << 42);
+		m_gpuHandle = static_cast<GPUImageHandle*>(instance->Cache().Acquire(key));
+		if (m_gpuHandle)
+			return;
+	}
 	m_gpuHandle = new GPUImageHandle();
+	m_gpuHandle->m_cacheKey = key;
+	m_gpuHandle->m_category = m_category;
 
 	VkImageCreateInfo imageInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
 	imageInfo.flags = 0;
@@ -41,7 +70,18 @@ void GPUImage::Allocate(Engine* instance)
 	VmaAllocationCreateInfo allocInfo = {};
 	allocInfo.usage = m_memoryUsage;
 
-	VK_CALL(vmaCreateImage(instance->Allocator(), &imageInfo, &allocInfo, &m_gpuHandle->m_image, &m_gpuHandle->m_allocation, nullptr));
+	VmaAllocationInfo allocationInfo;
+	VkResult result = vmaCreateImage(instance->Allocator(), &imageInfo, &allocInfo, &m_gpuHandle->m_image, &m_gpuHandle->m_allocation, &allocationInfo);
+	if (result != VK_SUCCESS)
+	{
+		LOG("GPU image allocation failed! VkResult " + std::to_string(result));
+		m_gpuHandle->m_image = nullptr;
+		m_gpuHandle->m_allocation = nullptr;
+		instance->Governor().AllocationFailed();
+		return;
+	}
+	m_gpuHandle->m_trackedBytes = allocationInfo.size;
+	instance->Governor().Track(m_category, (int64_t)allocationInfo.size);
 
 	if (m_createView)
 	{
@@ -1,5 +1,7 @@
 #pragma once
 #include "GPUResource.h"
+#include "ResourceCache.h"
+#include "MemoryGovernor.h"
 
 struct GPUImageHandle : GPUResourceHandle
 {
@@ -7,8 +9,12 @@ struct GPUImageHandle : GPUResourceHandle
 	VkImageView m_view = VK_NULL_HANDLE;
 	VkSampler m_sampler = VK_NULL_HANDLE;
 	VmaAllocation m_allocation = VK_NULL_HANDLE;
+	ResourceCacheKey m_cacheKey = {};//Set when allocated with GPUImage::m_recycle
+	MemoryCategory m_category = MEMORY_CATEGORY_OTHER;
+	VkDeviceSize m_trackedBytes = 0;//Reported to MemoryGovernor
 
 	void Deallocate(Engine* instance) override;
+	bool Recycle(Engine* instance, unsigned long long frame) override;
 };
 
 class GPUImage : public GPUResource
@@ -16,6 +22,8 @@ class GPUImage : public GPUResource
 public:
 
 	inline VkImage GetImage() { return m_gpuHandle ? m_gpuHandle->m_image : nullptr; }
+	//False after a failed Allocate, the empty handle still has to be released
+	inline bool Allocated() const { return m_gpuHandle && m_gpuHandle->m_image; }
 
 	void Allocate(Engine* instance) override;
 	void Release(Engine* instance) override;
@@ -35,4 +43,6 @@ public:
 	bool m_createSampler = false;
 	VkSamplerAddressMode wrapMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	float m_maxAnistrophy = 16.0f;
+	bool m_recycle = false;//Taken from and given back to ResourceCache, images without a sampler only
+	MemoryCategory m_category = MEMORY_CATEGORY_OTHER;
 };
\ No newline at end of file
@@ -10,6 +10,8 @@ class Engine;
 struct GPUResourceHandle
 {
 	virtual void Deallocate(Engine* instance) = 0;
+	//Called by the garbage collector once the GPU is done with the resource, true if it was kept for reuse instead
+	virtual bool Recycle(Engine* instance, unsigned long long frame) { return false; }
 
 	inline void Pin() { m_pinnedLevel++; }
 	inline void Unpin() { m_pinnedLevel--; }
@@ -0,0 +1,109 @@
+#include "MemoryGovernor.h"
+#include "..//Engine.h"
+#include <algorithm>
+
+void MemoryGovernor::Track(MemoryCategory category, int64_t byteCount)
+{
+	m_bytes[category].fetch_add(byteCount, std::memory_order_relaxed);
+}
+
+void MemoryGovernor::AllocationFailed()
+{
+	m_failures.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MemoryGovernor::SetHysteresis(uint32_t stepFrames, float releaseFraction)
+{
+	m_stepFrames = stepFrames;
+	m_releaseFraction = std::min(std::max(releaseFraction, 0.0f), 1.0f);
+}
+
+void MemoryGovernor::QueryBudget(VkPhysicalDevice physicalDevice)
+{
+	uint64_t tracked = 0;
+	for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+		tracked += (uint64_t)std::max(m_bytes[i].load(std::memory_order_relaxed), (int64_t)0);
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+	budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	VkPhysicalDeviceMemoryProperties2 memoryProperties = {};
+	memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+	bool budgetQuery = m_budgetExtension && vkGetPhysicalDeviceMemoryProperties2Fn;
+	if (budgetQuery)
+	{
+		memoryProperties.pNext = &budgetProperties;
+		vkGetPhysicalDeviceMemoryProperties2Fn(physicalDevice, &memoryProperties);
+	}
+	else
+	{
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties.memoryProperties);
+	}
+
+	uint64_t usage = 0;
+	uint64_t budget = 0;
+	const VkPhysicalDeviceMemoryProperties& heaps = memoryProperties.memoryProperties;
+	for (uint32_t i = 0; i < heaps.memoryHeapCount; i++)
+	{
+		if (!(heaps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+			continue;
+		if (budgetQuery)
+		{
+			usage += budgetProperties.heapUsage[i];
+			budget += budgetProperties.heapBudget[i];
+		}
+		else
+		{
+			budget += (uint64_t)(heaps.memoryHeaps[i].size * GOVERNOR_HEAP_FRACTION);
+		}
+	}
+	if (!budgetQuery)
+		usage = tracked;
+
+	uint64_t target = (uint64_t)(budget * GOVERNOR_TARGET_FRACTION);
+	if (m_userBudget > 0)
+		target = std::min(target, m_userBudget);
+	m_usage.store(usage, std::memory_order_relaxed);
+	m_budget.store(budget, std::memory_order_relaxed);
+	m_target.store(target, std::memory_order_relaxed);
+}
+
+void MemoryGovernor::Update(VkPhysicalDevice physicalDevice, unsigned long long frame)
+{
+	QueryBudget(physicalDevice);
+	if (frame < m_stepFrame + m_stepFrames)
+		return;
+
+	uint32_t failures = m_failures.load(std::memory_order_relaxed);
+	float scale = m_errorScale.load(std::memory_order_relaxed);
+	float next = scale;
+	uint64_t usage = m_usage.load(std::memory_order_relaxed);
+	uint64_t target = m_target.load(std::memory_order_relaxed);
+	if (usage > target || failures != m_stepFailures)
+		next = std::min(scale * GOVERNOR_ERROR_STEP, GOVERNOR_MAX_ERROR_SCALE);
+	else if (usage < (uint64_t)(target * m_releaseFraction))
+		next = std::max(scale / GOVERNOR_ERROR_STEP, 1.0f);
+	m_stepFailures = failures;
+
+	//A new scale changes every body's E and drops its incremental traversal cache, see VoxelBody::BeginIncrementalFrame.
+	//Steps are kept m_stepFrames apart so a body walks its whole tree at most that often.
+	if (next != scale)
+	{
+		m_errorScale.store(next, std::memory_order_relaxed);
+		m_stepFrame = frame;
+	}
+}
+
+MemoryStats MemoryGovernor::GetStats()
+{
+	MemoryStats stats = {};
+	uint64_t* categories[MEMORY_CATEGORY_COUNT] = { &stats.otherBytes, &stats.meshBytes, &stats.stagingBytes, &stats.materialBytes };
+	for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+		*categories[i] = (uint64_t)std::max(m_bytes[i].load(std::memory_order_relaxed), (int64_t)0);
+	stats.usage = m_usage.load(std::memory_order_relaxed);
+	stats.budget = m_budget.load(std::memory_order_relaxed);
+	stats.target = m_target.load(std::memory_order_relaxed);
+	stats.errorScale = m_errorScale.load(std::memory_order_relaxed);
+	stats.allocationFailures = m_failures.load(std::memory_order_relaxed);
+	stats.budgetExtension = m_budgetExtension && vkGetPhysicalDeviceMemoryProperties2Fn ? 1 : 0;
+	return stats;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "../VMA.h"
+#include <atomic>
+
+#define GOVERNOR_HEAP_FRACTION 0.8 //Share of the device local heaps assumed available without VK_EXT_memory_budget
+#define GOVERNOR_TARGET_FRACTION 0.9 //Share of the budget the governor keeps usage under
+#define GOVERNOR_RELEASE_FRACTION 0.75f //Default, detail is raised again once usage falls below this share of the target
+#define GOVERNOR_STEP_FRAMES 30U //Default frames between error scale steps, lets evictions show up in the usage
+#define GOVERNOR_ERROR_STEP 1.25f
+#define GOVERNOR_MAX_ERROR_SCALE 16.0f
+
+typedef enum MemoryCategory
+{
+	MEMORY_CATEGORY_OTHER = 0,
+	MEMORY_CATEGORY_MESH = 1,
+	MEMORY_CATEGORY_STAGING = 2,
+	MEMORY_CATEGORY_MATERIALS = 3,
+	MEMORY_CATEGORY_COUNT = 4
+} MemoryCategory;
+
+typedef struct MemoryStats
+{
+	uint64_t otherBytes;//Device memory allocated through GPUBuffer and GPUImage by category
+	uint64_t meshBytes;
+	uint64_t stagingBytes;
+	uint64_t materialBytes;
+	uint64_t usage;//Device local memory used by the process, the tracked total without VK_EXT_memory_budget
+	uint64_t budget;//Device local memory the process can use
+	uint64_t target;//What the governor keeps usage under
+	float errorScale;//Multiplier of the traversal error threshold
+	uint32_t allocationFailures;
+	uint32_t budgetExtension;//Usage and budget come from VK_EXT_memory_budget
+} MemoryStats;
+
+//Keeps device memory within budget by coarsening the octree.
+//GPUBuffer and GPUImage report what they allocate per category, usage and budget come from VK_EXT_memory_budget when enabled.
+//While usage is over the target the traversal error threshold is raised in steps, merging far subtrees and releasing their chunks,
+//and lowered again once usage has dropped well below it.
+class MemoryGovernor
+{
+public:
+	inline void SetBudgetExtension(bool enabled) { m_budgetExtension = enabled; }
+	//0 uses GOVERNOR_TARGET_FRACTION of the device budget
+	inline void SetBudget(uint64_t byteBudget) { m_userBudget = byteBudget; }
+	//Every scale step makes incrementally traversed bodies walk their whole tree once.
+	//Longer steps and a lower release fraction trade how fast detail follows the budget for fewer of those walks.
+	void SetHysteresis(uint32_t stepFrames, float releaseFraction);
+
+	void Track(MemoryCategory category, int64_t byteCount);
+	void AllocationFailed();
+	//Refreshes usage and budget and steps the error scale, once per frame
+	void Update(VkPhysicalDevice physicalDevice, unsigned long long frame);
+
+	inline float ErrorScale() const { return m_errorScale.load(std::memory_order_relaxed); }
+	MemoryStats GetStats();
+
+private:
+	void QueryBudget(VkPhysicalDevice physicalDevice);
+
+	std::atomic<int64_t> m_bytes[MEMORY_CATEGORY_COUNT] = {};
+	std::atomic<uint32_t> m_failures = { 0 };
+	std::atomic<float> m_errorScale = { 1.0f };
+	bool m_budgetExtension = false;
+	uint64_t m_userBudget = 0;
+
+	std::atomic<uint64_t> m_usage = { 0 };
+	std::atomic<uint64_t> m_budget = { 0 };
+	std::atomic<uint64_t> m_target = { 0 };
+	uint32_t m_stepFrames = GOVERNOR_STEP_FRAMES;
+	float m_releaseFraction = GOVERNOR_RELEASE_FRACTION;
+	uint32_t m_stepFailures = 0;//m_failures at the last step
+	unsigned long long m_stepFrame = 0;
+};
@@ -0,0 +1,322 @@
+#include "MeshArena.h"
+#include "..//Engine.h"
+#include "..//Plugin.h"
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define ALIGN_UP(size) (((size) + MESH_ARENA_ALIGNMENT - 1) & ~(MESH_ARENA_ALIGNMENT - 1))
+
+static inline uint32_t LowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+static inline uint32_t HighestBit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+//Sizes are counted in alignment units, the first level holds every size below MESH_ARENA_SL_COUNT units linearly
+static inline void Mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl)
+{
+	VkDeviceSize units = size / MESH_ARENA_ALIGNMENT;
+	if (units < MESH_ARENA_SL_COUNT)
+	{
+		fl = 0;
+		sl = (uint32_t)units;
+		return;
+	}
+	uint32_t log2 = HighestBit(units);
+	fl = log2 - MESH_ARENA_SL_BITS + 1;
+	sl = (uint32_t)(units >> (log2 - MESH_ARENA_SL_BITS)) - MESH_ARENA_SL_COUNT;
+}
+
+void MeshRangeHandle::Deallocate(Engine* instance)
+{
+	if (m_arena)
+		m_arena->Free(this);
+	m_arena = nullptr;
+	m_block = nullptr;
+	m_buffer = VK_NULL_HANDLE;
+}
+
+MeshArena::MeshArena(VkBufferUsageFlags usage, VkDeviceSize pageSize)
+{
+	m_usage = usage;
+	m_pageSize = ALIGN_UP(pageSize);
+}
+
+MeshArena::~MeshArena()
+{
+	for (MeshArenaBlock* block : m_blocks)
+	{
+		while (block)
+		{
+			MeshArenaBlock* next = block->nextPhysical;
+			delete block;
+			block = next;
+		}
+	}
+}
+
+void MeshArena::Release(Engine* instance)
+{
+	//Runs after the final garbage collection, no range is alive anymore
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (m_usedBytes > 0)
+		LOG("ERROR: Mesh arena released with " + std::to_string(m_usedBytes) + " bytes in use");
+
+	for (GPUBuffer& page : m_pages)
+	{
+		if (page.m_gpuHandle)
+			page.m_gpuHandle->Deallocate(instance);
+		SAFE_DEL(page.m_gpuHandle);
+	}
+	for (MeshArenaBlock* block : m_blocks)
+	{
+		while (block)
+		{
+			MeshArenaBlock* next = block->nextPhysical;
+			delete block;
+			block = next;
+		}
+	}
+	m_pages.clear();
+	m_blocks.clear();
+	m_usedBytes = 0;
+	m_rangeCount = 0;
+	m_flBitmap = 0;
+	std::memset(m_slBitmap, 0, sizeof(m_slBitmap));
+	std::memset(m_freeLists, 0, sizeof(m_freeLists));
+}
+
+bool MeshArena::Allocate(Engine* instance, GPUBuffer& buffer, VkDeviceSize byteCount)
+{
+	if (buffer.m_gpuHandle)
+	{
+		LOG("Mesh range allocation failed! Already allocated!");
+		return false;
+	}
+
+	VkDeviceSize size = ALIGN_UP(std::max(byteCount, (VkDeviceSize)1));
+	if (size > m_pageSize)
+	{
+		LOG("Mesh range allocation failed! " + std::to_string(byteCount) + " bytes exceed the arena page size");
+		return false;
+	}
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	MeshArenaBlock* block = FindFree(size);
+	if (!block)
+	{
+		AddPage(instance);
+		block = FindFree(size);
+		if (!block)
+			return false;
+	}
+	RemoveFree(block);
+	block->free = false;
+	Split(block, size);
+
+	MeshRangeHandle* range = new MeshRangeHandle();
+	range->m_arena = this;
+	range->m_block = block;
+	range->m_buffer = m_pages[block->page].m_gpuHandle->m_buffer;
+	range->m_offset = block->offset;
+	m_usedBytes += block->size;
+	m_rangeCount++;
+
+	buffer.m_gpuHandle = range;
+	buffer.m_byteCount = byteCount;
+	return true;
+}
+
+void MeshArena::Shrink(GPUBuffer& buffer, VkDeviceSize byteCount)
+{
+	MeshArenaBlock* block = static_cast<MeshRangeHandle*>(buffer.m_gpuHandle)->m_block;
+	VkDeviceSize size = ALIGN_UP(std::max(byteCount, (VkDeviceSize)1));
+	buffer.m_byteCount = byteCount;
+	if (size >= block->size)
+		return;
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_usedBytes -= block->size - size;
+	Split(block, size);
+}
+
+void MeshArena::Free(MeshRangeHandle* range)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	MeshArenaBlock* block = range->m_block;
+	if (!block)
+		return;
+
+	m_usedBytes -= block->size;
+	m_rangeCount--;
+	block->free = true;
+	InsertFree(Merge(block));
+}
+
+MeshArenaStats MeshArena::GetStats()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	MeshArenaStats stats = {};
+	stats.usedBytes = m_usedBytes;
+	stats.capacityBytes = CapacityBytes();
+	stats.rangeCount = m_rangeCount;
+	stats.pageCount = (uint32_t)m_pages.size();
+	for (MeshArenaBlock* block : m_blocks)
+	{
+		for (; block; block = block->nextPhysical)
+		{
+			if (!block->free)
+				continue;
+			stats.freeBlockCount++;
+			stats.largestFreeBytes = std::max(stats.largestFreeBytes, (uint64_t)block->size);
+		}
+	}
+	return stats;
+}
+
+void MeshArena::AddPage(Engine* instance)
+{
+	GPUBuffer page;
+	page.m_bufferUsage = m_usage;
+	page.m_memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
+	page.m_byteCount = m_pageSize;
+	page.m_category = MEMORY_CATEGORY_MESH;
+	page.Allocate(instance);
+	if (!page.m_gpuHandle->m_buffer)
+	{
+		LOG("Mesh arena failed to allocate a page");
+		SAFE_DEL(page.m_gpuHandle);
+		return;
+	}
+
+	MeshArenaBlock* block = new MeshArenaBlock();
+	block->page = (uint32_t)m_pages.size();
+	block->size = m_pageSize;
+	block->free = true;
+	m_pages.push_back(page);
+	m_blocks.push_back(block);
+	InsertFree(block);
+}
+
+MeshArenaBlock* MeshArena::FindFree(VkDeviceSize size)
+{
+	//Round up to the next list boundary so any block found there fits
+	VkDeviceSize units = size / MESH_ARENA_ALIGNMENT;
+	if (units >= MESH_ARENA_SL_COUNT)
+		size += ((VkDeviceSize)1 << (HighestBit(units) - MESH_ARENA_SL_BITS)) * MESH_ARENA_ALIGNMENT - MESH_ARENA_ALIGNMENT;
+
+	uint32_t fl, sl;
+	Mapping(size, fl, sl);
+	if (fl >= MESH_ARENA_FL_COUNT)
+		return nullptr;
+
+	uint32_t slMask = m_slBitmap[fl] & (~0U << sl);
+	if (!slMask)
+	{
+		uint32_t flMask = fl + 1 < MESH_ARENA_FL_COUNT ? m_flBitmap & (~0U << (fl + 1)) : 0;
+		if (!flMask)
+			return nullptr;
+		fl = LowestBit(flMask);
+		slMask = m_slBitmap[fl];
+	}
+	sl = LowestBit(slMask);
+	return m_freeLists[fl][sl];
+}
+
+void MeshArena::InsertFree(MeshArenaBlock* block)
+{
+	uint32_t fl, sl;
+	Mapping(block->size, fl, sl);
+	block->prevFree = nullptr;
+	block->nextFree = m_freeLists[fl][sl];
+	if (block->nextFree)
+		block->nextFree->prevFree = block;
+	m_freeLists[fl][sl] = block;
+	m_flBitmap |= 1U << fl;
+	m_slBitmap[fl] |= 1U << sl;
+}
+
+void MeshArena::RemoveFree(MeshArenaBlock* block)
+{
+	uint32_t fl, sl;
+	Mapping(block->size, fl, sl);
+	if (block->prevFree)
+		block->prevFree->nextFree = block->nextFree;
+	else
+		m_freeLists[fl][sl] = block->nextFree;
+	if (block->nextFree)
+		block->nextFree->prevFree = block->prevFree;
+	block->prevFree = nullptr;
+	block->nextFree = nullptr;
+
+	if (!m_freeLists[fl][sl])
+	{
+		m_slBitmap[fl] &= ~(1U << sl);
+		if (!m_slBitmap[fl])
+			m_flBitmap &= ~(1U << fl);
+	}
+}
+
+void MeshArena::Split(MeshArenaBlock* block, VkDeviceSize size)
+{
+	if (block->size <= size)
+		return;
+
+	MeshArenaBlock* remainder = new MeshArenaBlock();
+	remainder->page = block->page;
+	remainder->offset = block->offset + size;
+	remainder->size = block->size - size;
+	remainder->free = true;
+	remainder->prevPhysical = block;
+	remainder->nextPhysical = block->nextPhysical;
+	if (remainder->nextPhysical)
+		remainder->nextPhysical->prevPhysical = remainder;
+	block->nextPhysical = remainder;
+	block->size = size;
+	InsertFree(Merge(remainder));
+}
+
+MeshArenaBlock* MeshArena::Merge(MeshArenaBlock* block)
+{
+	MeshArenaBlock* next = block->nextPhysical;
+	if (next && next->free)
+	{
+		RemoveFree(next);
+		block->size += next->size;
+		block->nextPhysical = next->nextPhysical;
+		if (block->nextPhysical)
+			block->nextPhysical->prevPhysical = block;
+		delete next;
+	}
+
+	MeshArenaBlock* prev = block->prevPhysical;
+	if (prev && prev->free)
+	{
+		RemoveFree(prev);
+		prev->size += block->size;
+		prev->nextPhysical = block->nextPhysical;
+		if (prev->nextPhysical)
+			prev->nextPhysical->prevPhysical = prev;
+		delete block;
+		block = prev;
+	}
+	return block;
+}
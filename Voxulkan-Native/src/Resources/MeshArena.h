@@ -0,0 +1,86 @@
+#pragma once
+#include "GPUBuffer.h"
+#include <mutex>
+#include <vector>
+
+#define MESH_ARENA_PAGE_SIZE (64ULL << 20)
+#define MESH_ARENA_ALIGNMENT 256ULL //Largest minStorageBufferOffsetAlignment the spec allows
+#define MESH_ARENA_SL_BITS 4U
+#define MESH_ARENA_SL_COUNT (1U << MESH_ARENA_SL_BITS)
+#define MESH_ARENA_FL_COUNT 32U
+
+class MeshArena;
+
+typedef struct MeshArenaStats
+{
+	uint64_t usedBytes;
+	uint64_t capacityBytes;
+	uint64_t largestFreeBytes;
+	uint32_t rangeCount;
+	uint32_t freeBlockCount;
+	uint32_t pageCount;
+} MeshArenaStats;
+
+//Contiguous piece of a page, either a live range or a free block. Neighbours in the page are linked for coalescing.
+struct MeshArenaBlock
+{
+	uint32_t page = 0;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	bool free = false;
+	MeshArenaBlock* prevPhysical = nullptr;
+	MeshArenaBlock* nextPhysical = nullptr;
+	MeshArenaBlock* prevFree = nullptr;
+	MeshArenaBlock* nextFree = nullptr;
+};
+
+//Range of an arena page, returned to the arena once the garbage collector deallocates it
+struct MeshRangeHandle : GPUBufferHandle
+{
+	MeshArena* m_arena = nullptr;
+	MeshArenaBlock* m_block = nullptr;
+
+	void Deallocate(Engine* instance) override;
+};
+
+//Chunk vertex and index data sub-allocated from a few large buffers with a two-level segregated fit (TLSF) allocator.
+//Allocation and release are O(1), ranges can shrink in place so a build can reserve room before the GPU knows its mesh size,
+//and chunks sharing a page are drawn with one vertex/index buffer binding through vertexOffset/firstIndex.
+class MeshArena
+{
+public:
+	MeshArena(VkBufferUsageFlags usage, VkDeviceSize pageSize = MESH_ARENA_PAGE_SIZE);
+	~MeshArena();
+	void Release(Engine* instance);
+
+	//Points buffer at a new range of byteCount bytes, buffer.m_gpuHandle must be empty
+	bool Allocate(Engine* instance, GPUBuffer& buffer, VkDeviceSize byteCount);
+	//Returns everything past byteCount of the range to the arena
+	void Shrink(GPUBuffer& buffer, VkDeviceSize byteCount);
+	void Free(MeshRangeHandle* range);
+
+	inline VkDeviceSize UsedBytes() const { return m_usedBytes; }
+	inline VkDeviceSize CapacityBytes() const { return (VkDeviceSize)m_pages.size() * m_pageSize; }
+	MeshArenaStats GetStats();
+
+private:
+	void AddPage(Engine* instance);
+	MeshArenaBlock* FindFree(VkDeviceSize size);
+	void InsertFree(MeshArenaBlock* block);
+	void RemoveFree(MeshArenaBlock* block);
+	//Cuts block down to size and files the remainder as free, merged with its next neighbour
+	void Split(MeshArenaBlock* block, VkDeviceSize size);
+	MeshArenaBlock* Merge(MeshArenaBlock* block);
+
+	VkBufferUsageFlags m_usage = 0;
+	VkDeviceSize m_pageSize = 0;
+	VkDeviceSize m_usedBytes = 0;
+	uint32_t m_rangeCount = 0;
+	std::mutex m_lock;
+	std::vector<GPUBuffer> m_pages = {};
+	std::vector<MeshArenaBlock*> m_blocks = {};//First block of every page
+
+	uint32_t m_flBitmap = 0;
+	uint32_t m_slBitmap[MESH_ARENA_FL_COUNT] = {};
+	MeshArenaBlock* m_freeLists[MESH_ARENA_FL_COUNT][MESH_ARENA_SL_COUNT] = {};
+};
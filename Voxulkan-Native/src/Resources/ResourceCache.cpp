@@ -0,0 +1,117 @@
+#include "ResourceCache.h"
+#include "GPUResource.h"
+#include "..//Engine.h"
+#include <tuple>
+
+bool ResourceCacheKey::operator<(const ResourceCacheKey& rhs) const
+{
+	return std::tie(kind, usage, memoryUsage, format, type, viewType, tiling, arraySize, size) <
+		std::tie(rhs.kind, rhs.usage, rhs.memoryUsage, rhs.format, rhs.type, rhs.viewType, rhs.tiling, rhs.arraySize, rhs.size);
+}
+
+void ResourceCache::Release(Engine* instance)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (auto& bucket : m_entries)
+	{
+		for (Entry& entry : bucket.second)
+		{
+			entry.handle->Deallocate(instance);
+			delete entry.handle;
+		}
+	}
+	m_entries.clear();
+	m_idleBytes = 0;
+	m_idleCount = 0;
+}
+
+VkDeviceSize ResourceCache::BufferClass(VkDeviceSize byteCount)
+{
+	if (byteCount <= RESOURCE_CACHE_MIN_BYTES)
+		return RESOURCE_CACHE_MIN_BYTES;
+	uint32_t fl = 63U;
+	while (!(byteCount >> fl))
+		fl--;
+	VkDeviceSize step = 1ULL << (fl - RESOURCE_CACHE_SL_BITS);
+	return (byteCount + step - 1ULL) & ~(step - 1ULL);
+}
+
+GPUResourceHandle* ResourceCache::Acquire(const ResourceCacheKey& key)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto bucket = m_entries.find(key);
+	if (bucket == m_entries.end() || bucket->second.empty())
+	{
+		m_misses++;
+		return nullptr;
+	}
+	Entry entry = bucket->second.back();
+	bucket->second.pop_back();
+	m_idleBytes -= entry.byteCount;
+	m_idleCount--;
+	m_hits++;
+	return entry.handle;
+}
+
+bool ResourceCache::Return(GPUResourceHandle* handle, const ResourceCacheKey& key, VkDeviceSize byteCount, unsigned long long frame)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_idleBytes + byteCount > m_byteBudget)
+	{
+		m_evictions++;
+		return false;
+	}
+	Entry entry = {};
+	entry.handle = handle;
+	entry.byteCount = byteCount;
+	entry.frame = frame;
+	m_entries[key].push_back(entry);
+	m_idleBytes += byteCount;
+	m_idleCount++;
+	return true;
+}
+
+void ResourceCache::Trim(Engine* instance, unsigned long long frame)
+{
+	if (frame <= RESOURCE_CACHE_IDLE_FRAMES)
+		return;
+	unsigned long long oldest = frame - RESOURCE_CACHE_IDLE_FRAMES;
+
+	std::vector<GPUResourceHandle*> expired;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (auto& bucket : m_entries)
+		{
+			std::vector<Entry>& entries = bucket.second;
+			size_t count = 0;
+			while (count < entries.size() && entries[count].frame < oldest)
+			{
+				expired.push_back(entries[count].handle);
+				m_idleBytes -= entries[count].byteCount;
+				count++;
+			}
+			entries.erase(entries.begin(), entries.begin() + count);
+		}
+		m_idleCount -= (uint32_t)expired.size();
+		m_evictions += expired.size();
+	}
+
+	for (GPUResourceHandle* handle : expired)
+	{
+		handle->Deallocate(instance);
+		delete handle;
+	}
+}
+
+ResourceCacheStats ResourceCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	ResourceCacheStats stats = {};
+	stats.hits = m_hits;
+	stats.misses = m_misses;
+	stats.evictions = m_evictions;
+	stats.idleBytes = m_idleBytes;
+	stats.byteBudget = m_byteBudget;
+	stats.idleCount = m_idleCount;
+	return stats;
+}
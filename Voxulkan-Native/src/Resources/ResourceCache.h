@@ -0,0 +1,85 @@
+#pragma once
+#include "../VMA.h"
+#include <map>
+#include <mutex>
+#include <vector>
+
+#define RESOURCE_CACHE_SL_BITS 2U //Buffer size classes per power of two, a class wastes at most 1/4 of its size
+#define RESOURCE_CACHE_MIN_BYTES 256ULL
+#define RESOURCE_CACHE_BYTE_BUDGET (256ULL << 20) //Idle device memory kept for reuse
+#define RESOURCE_CACHE_IDLE_FRAMES 600ULL //Idle resources older than this are destroyed
+
+class Engine;
+struct GPUResourceHandle;
+
+typedef enum ResourceCacheKind
+{
+	RESOURCE_CACHE_NONE = 0,//Not recycled
+	RESOURCE_CACHE_BUFFER = 1,
+	RESOURCE_CACHE_IMAGE = 2,
+} ResourceCacheKind;
+
+//Everything a recycled resource has to match, buffers by size class and images by exact extent
+struct ResourceCacheKey
+{
+	ResourceCacheKind kind = RESOURCE_CACHE_NONE;
+	uint32_t usage = 0;
+	uint32_t memoryUsage = 0;
+	uint32_t format = 0;
+	uint32_t type = 0;
+	uint32_t viewType = 0;
+	uint32_t tiling = 0;
+	uint32_t arraySize = 0;
+	uint64_t size = 0;
+
+	bool operator<(const ResourceCacheKey& rhs) const;
+};
+
+typedef struct ResourceCacheStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;//Idle resources destroyed by age or budget
+	uint64_t idleBytes;
+	uint64_t byteBudget;
+	uint32_t idleCount;
+} ResourceCacheStats;
+
+//Idle buffers and images handed back by the garbage collector once the GPU is done with them.
+//GPUBuffer and GPUImage with m_recycle set take a matching resource from here before creating one,
+//which keeps vmaCreate*/vmaDestroy* out of the frames where chunks are continuously replaced.
+class ResourceCache
+{
+public:
+	void Release(Engine* instance);
+
+	//Size a buffer of byteCount bytes is allocated with, the top of its size class
+	static VkDeviceSize BufferClass(VkDeviceSize byteCount);
+
+	//Returns an idle handle for key or nullptr
+	GPUResourceHandle* Acquire(const ResourceCacheKey& key);
+	//Takes an idle handle of the given key retired in frame, false if it does not fit the budget
+	bool Return(GPUResourceHandle* handle, const ResourceCacheKey& key, VkDeviceSize byteCount, unsigned long long frame);
+	//Destroys resources idle for more than RESOURCE_CACHE_IDLE_FRAMES
+	void Trim(Engine* instance, unsigned long long frame);
+
+	inline void SetBudget(uint64_t byteBudget) { m_byteBudget = byteBudget; }
+	ResourceCacheStats GetStats();
+
+private:
+	struct Entry
+	{
+		GPUResourceHandle* handle = nullptr;
+		VkDeviceSize byteCount = 0;
+		unsigned long long frame = 0;
+	};
+
+	std::mutex m_lock;
+	std::map<ResourceCacheKey, std::vector<Entry>> m_entries = {};//Oldest first, reused from the back
+	uint64_t m_byteBudget = RESOURCE_CACHE_BYTE_BUDGET;
+	uint64_t m_idleBytes = 0;
+	uint32_t m_idleCount = 0;
+	uint64_t m_hits = 0;
+	uint64_t m_misses = 0;
+	uint64_t m_evictions = 0;
+};
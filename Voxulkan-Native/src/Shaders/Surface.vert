@@ -1,7 +1,7 @@
 #version 430
-layout(location = 0) in vec3 vPos;
-layout(location = 1) in vec3 vNrm;
-layout(location = 2) in uint vID;
+layout(location = 0) in uvec2 vPacked;//See SurfaceAssembly.comp
+layout(location = 1) in vec3 vChunkOffset;//Per instance, the header in front of the chunk's vertices
+layout(location = 2) in vec3 vChunkScale;
 
 layout(location = 0) out vec4 outMPos;
 layout(location = 1) out vec4 outMNrm;
@@ -16,9 +16,23 @@ layout(push_constant) uniform Constants
 };
 
 #define CLIP_SCALE 1.1
+#define POSITION_SCALE 64.0
+
+vec3 OctahedralDecode(uvec2 e)
+{
+	vec2 o = vec2(e) / 1023.0 * 2.0 - 1.0;
+	vec3 n = vec3(o, 1.0 - abs(o.x) - abs(o.y));
+	if(n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
 
 void main()
 {
+	vec3 cellPos = vec3(vPacked.x & 0xFFF, (vPacked.x >> 12) & 0xFFF, vPacked.y & 0xFFF) / POSITION_SCALE;
+	vec3 vPos = vChunkOffset + vChunkScale * cellPos;
+	uint vID = vPacked.x >> 24;
+
 	vec4 clip = mvp * vec4(vPos.rgb, 1.0);
 	clip.xyz /= clip.w;
 	gl_Position = vec4(
@@ -28,7 +42,7 @@ void main()
 
 	outID = vID;
 	outMPos.xyz = vPos;
-	outMNrm.xyz = normalize(vNrm * 2.0 - 1.0);
+	outMNrm.xyz = OctahedralDecode(uvec2((vPacked.y >> 12) & 0x3FF, vPacked.y >> 22));
 	vec3 viewDir = (model * vec4(vPos, 1.0)).xyz - cameraPosition;
 	float viewDist = length(viewDir);
 	viewDir /= viewDist;
@@ -0,0 +1,127 @@
+#include "TaskScheduler.h"
+#include "Plugin.h"
+
+TaskScheduler::TaskScheduler(uint32_t threadCount)
+{
+	m_threadCount = threadCount;
+	m_queues = new WorkerQueue[threadCount > 0 ? threadCount : 1];
+	m_threads.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; i++)
+		m_threads.emplace_back(&TaskScheduler::WorkerLoop, this, i);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_sleepLock);
+		m_running.store(false);
+	}
+	m_wake.notify_all();
+	for (std::thread& thread : m_threads)
+		thread.join();
+	SAFE_DEL_ARR(m_queues);
+}
+
+void TaskScheduler::RunTask(Task& task)
+{
+	task.function(task.data, task.index);
+	Batch* batch = task.batch;
+	if (batch->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+	//The batch may be gone as soon as the lock is released
+	std::lock_guard<std::mutex> guard(batch->lock);
+	batch->done = true;
+	batch->complete.notify_all();
+}
+
+void TaskScheduler::ParallelFor(uint32_t count, TaskFunction function, void* data)
+{
+	if (count == 0)
+		return;
+
+	uint32_t threadCount = ThreadCount();
+	if (threadCount == 0 || count == 1)
+	{
+		for (uint32_t i = 0; i < count; i++)
+			function(data, i);
+		return;
+	}
+
+	Batch batch;
+	batch.remaining.store(count);
+	{
+		//Counted before the push so a worker never sees more tasks than pending
+		std::lock_guard<std::mutex> guard(m_sleepLock);
+		m_pending.fetch_add(count);
+	}
+
+	uint32_t queue = m_nextQueue.fetch_add(1, std::memory_order_relaxed);
+	for (uint32_t i = 0; i < count; i++, queue++)
+	{
+		Task task;
+		task.function = function;
+		task.data = data;
+		task.index = i;
+		task.batch = &batch;
+
+		WorkerQueue& wq = m_queues[queue % threadCount];
+		std::lock_guard<std::mutex> guard(wq.lock);
+		wq.tasks.push_back(task);
+	}
+
+	m_wake.notify_all();
+
+	//Help out while anything is queued, any batch's task is fair game.
+	//Tasks are never queued again once taken, so after a failed pass the rest of the batch is running elsewhere.
+	Task task;
+	while (batch.remaining.load(std::memory_order_acquire) > 0 && StealTask(threadCount, task))
+		RunTask(task);
+
+	std::unique_lock<std::mutex> lock(batch.lock);
+	batch.complete.wait(lock, [&batch] { return batch.done; });
+}
+
+bool TaskScheduler::PopTask(uint32_t workerIndex, Task& task)
+{
+	WorkerQueue& wq = m_queues[workerIndex];
+	std::lock_guard<std::mutex> guard(wq.lock);
+	if (wq.tasks.empty())
+		return false;
+	task = wq.tasks.back();
+	wq.tasks.pop_back();
+	m_pending.fetch_sub(1);
+	return true;
+}
+
+bool TaskScheduler::StealTask(uint32_t thiefIndex, Task& task)
+{
+	uint32_t threadCount = ThreadCount();
+	for (uint32_t i = 1; i <= threadCount; i++)
+	{
+		WorkerQueue& wq = m_queues[(thiefIndex + i) % threadCount];
+		std::lock_guard<std::mutex> guard(wq.lock);
+		if (wq.tasks.empty())
+			continue;
+		task = wq.tasks.front();
+		wq.tasks.pop_front();
+		m_pending.fetch_sub(1);
+		return true;
+	}
+	return false;
+}
+
+void TaskScheduler::WorkerLoop(uint32_t workerIndex)
+{
+	Task task;
+	while (m_running.load())
+	{
+		if (PopTask(workerIndex, task) || StealTask(workerIndex, task))
+		{
+			RunTask(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepLock);
+		m_wake.wait(lock, [this] { return !m_running.load() || m_pending.load() > 0; });
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+//Small work-stealing pool used to split CPU work (e.g. octree traversal) of a single call across cores.
+//Every worker owns a deque, it pops its own tasks from the back and steals from the front of the others.
+//The submitting thread helps until no task of its batch is queued, then sleeps until the batch is complete.
+class TaskScheduler
+{
+public:
+	typedef void(*TaskFunction)(void* data, uint32_t index);
+
+	TaskScheduler(uint32_t threadCount);
+	~TaskScheduler();
+
+	//Runs function(data, i) for i in [0, count) and returns once all of them finished
+	void ParallelFor(uint32_t count, TaskFunction function, void* data);
+	inline uint32_t ThreadCount() const { return m_threadCount; }
+
+private:
+	//Completion of one ParallelFor call, lives on the submitting thread's stack
+	struct Batch
+	{
+		std::atomic<uint32_t> remaining = { 0 };
+		std::mutex lock;
+		std::condition_variable complete;
+		bool done = false;//Set under lock by the last task, the submitter only returns once it saw it
+	};
+
+	struct Task
+	{
+		TaskFunction function = nullptr;
+		void* data = nullptr;
+		uint32_t index = 0;
+		Batch* batch = nullptr;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	void WorkerLoop(uint32_t workerIndex);
+	bool PopTask(uint32_t workerIndex, Task& task);
+	bool StealTask(uint32_t thiefIndex, Task& task);
+	static void RunTask(Task& task);
+
+	std::vector<std::thread> m_threads;
+	uint32_t m_threadCount = 0;
+	WorkerQueue* m_queues = nullptr;
+	std::atomic<uint32_t> m_nextQueue = { 0 };
+	std::atomic<uint32_t> m_pending = { 0 };
+	std::atomic<bool> m_running = { true };
+	std::mutex m_sleepLock;
+	std::condition_variable m_wake;
+};